@@ -1,14 +1,18 @@
 import sys
 import time
-from random import randint
+from random import getrandbits
 
-import pygame
-from cpuinfo import get_cpu_info
+try:
+    import pygame
+except ImportError:
+    pygame = None  # only needed for the window, not for --trace and --cycles
+
+MASK64 = (1 << 64) - 1
 
 
 class C8Interpreter:
 
-    def __init__(self, rom_file):
+    def __init__(self, rom_file, headless=False, seed=None):
         self.running = True
         self.memory = [0] * 4096  # 4KB memory
         self.V = [0] * 16  # registers
@@ -19,6 +23,14 @@ class C8Interpreter:
         self.stack = []  # stack for subroutine calls
         self.keys = [0] * 16  # keypad with 16 keys
         self.prev_keys = [0] * 16  # previous frame key states
+        self.seed(getrandbits(64) if seed is None else seed)
+
+        # prepare memory
+        self._load_rom(rom_file)
+        self._load_fontset()
+
+        if headless:
+            return
 
         # key mapping for Chip-8 keys
         self.mapping = {
@@ -45,12 +57,26 @@ class C8Interpreter:
         self.scale = 20
         self.screen = pygame.display.set_mode((64 * self.scale, 32 * self.scale))
 
-        # prepare memory
-        self._load_rom(rom_file)
-        self._load_fontset()
-
     def __del__(self):
-        pygame.quit()
+        if pygame:
+            pygame.quit()
+
+    def seed(self, seed):
+        # same generator as sea8 (splitmix64 seeding, xorshift64*), so traces
+        # with the same seed can be compared
+        z = (seed + 0x9E3779B97F4A7C15) & MASK64
+        z = ((z ^ (z >> 30)) * 0xBF58476D1CE4E5B9) & MASK64
+        z = ((z ^ (z >> 27)) * 0x94D049BB133111EB) & MASK64
+        z ^= z >> 31
+        self.rng_state = z if z else 1
+
+    def random_byte(self):
+        x = self.rng_state
+        x ^= x >> 12
+        x ^= (x << 25) & MASK64
+        x ^= x >> 27
+        self.rng_state = x
+        return ((x * 0x2545F4914F6CDD1D) & MASK64) >> 56
 
     def _load_rom(self, rom_file):
         with open(rom_file, "rb") as f:
@@ -270,7 +296,7 @@ class C8Interpreter:
             elif first_nibble == 0xC000:
                 # opcode 0xCXNN
                 # set VX to random byte AND NN
-                V[(opcode & 0x0F00) >> 8] = randint(0, 255) & opcode & 0x00FF
+                V[(opcode & 0x0F00) >> 8] = self.random_byte() & opcode & 0x00FF
 
             elif first_nibble == 0xE000:
 
@@ -455,10 +481,88 @@ class C8Interpreter:
             if pressed[key]:
                 self.keys[chip_key] = 1
 
+    def set_keys(self, key_mask):
+        # headless input, bit k of key_mask is key k
+        self.prev_keys = self.keys[:]
+        self.keys = [(key_mask >> k) & 1 for k in range(16)]
+
     def update_timers(self):
         if self.delay_timer > 0:
             self.delay_timer -= 1
 
+    def trace_line(self, frame):
+        # same format as sea8 --trace: frame pc I V0..VF delay_timer gfx,
+        # gfx is the FNV-1a hash of one byte per pixel
+        gfx_hash = 0xCBF29CE484222325
+        for pixel in self.gfx:
+            gfx_hash = ((gfx_hash ^ pixel) * 0x100000001B3) & MASK64
+        return "{} {:03x} {:03x} {} {:02x} {:016x}".format(
+            frame,
+            self.pc,
+            self.I,
+            bytes(self.V).hex(),
+            self.delay_timer,
+            gfx_hash,
+        )
+
+
+def load_key_script(path):
+    # one "FRAME KEYS" pair per line, KEYS a hex mask held from that frame
+    # on, # starts a comment
+    # same messages and exit code as sea8 and rusty8 for a bad script
+    script = []
+    try:
+        with open(path) as f:
+            lines = f.readlines()
+    except OSError:
+        sys.exit("Failed to open key script: {}".format(path))
+
+    for line_no, line in enumerate(lines, 1):
+        fields = line.split("#")[0].split()
+        if not fields:
+            continue
+        try:
+            frame, keys = int(fields[0]), int(fields[1], 16)
+        except (ValueError, IndexError):
+            frame = keys = -1
+        if frame < 0 or not 0 <= keys <= 0xFFFF or (script and frame < script[-1][0]):
+            sys.exit("Bad key script line {}: {}".format(line_no, path))
+        script.append((frame, keys))
+    return script
+
+
+def run_trace(rom_file, frames, seed, script):
+    # one state line per frame: apply the key script, tick the timers,
+    # run 11 instructions (see sea8 --trace)
+    interpreter = C8Interpreter(rom_file, headless=True, seed=seed)
+    keys = 0
+    pos = 0
+
+    for frame in range(frames):
+        while pos < len(script) and script[pos][0] <= frame:
+            keys = script[pos][1]
+            pos += 1
+        interpreter.set_keys(keys)
+        interpreter.update_timers()
+        interpreter.emulate_instruction(11)
+        print(interpreter.trace_line(frame))
+
+
+def run_benchmark(rom_file, cycles, seed):
+    interpreter = C8Interpreter(rom_file, headless=True, seed=seed)
+
+    start_time = time.perf_counter()
+    for _ in range(cycles // 11):
+        interpreter.update_timers()
+        interpreter.emulate_instruction(11)
+    interpreter.emulate_instruction(cycles % 11)
+    elapsed = time.perf_counter() - start_time
+
+    print("engine:       pyslow8")
+    print("instructions: {}".format(cycles))
+    print("wall time:    {:.6f} s".format(elapsed))
+    print("instr/sec:    {:.0f} ({:.2f} MIPS)".format(cycles / elapsed, cycles / elapsed / 1e6))
+
 
 def main(rom_file, system_info):
     interpreter = C8Interpreter(rom_file)
@@ -498,14 +602,31 @@ def main(rom_file, system_info):
 
 
 if __name__ == "__main__":
-    if len(sys.argv) != 2:
-        print("Usage: python main.py <ROM>")
+    usage = "Usage: python main.py [--trace FRAMES [--keys FILE] | --cycles N] [--seed N] <ROM>"
+    args = sys.argv[1:]
+    options = {}
+    while len(args) > 1 and args[0] in ("--trace", "--keys", "--cycles", "--seed"):
+        options[args[0]] = args[1]
+        args = args[2:]
+    if len(args) != 1:
+        print(usage)
         sys.exit(1)
 
+    seed = int(options["--seed"]) if "--seed" in options else None
+    if "--trace" in options:
+        script = load_key_script(options["--keys"]) if "--keys" in options else []
+        run_trace(args[0], int(options["--trace"]), 0 if seed is None else seed, script)
+        sys.exit(0)
+    if "--cycles" in options:
+        run_benchmark(args[0], int(options["--cycles"]), 0 if seed is None else seed)
+        sys.exit(0)
+
+    from cpuinfo import get_cpu_info
+
     system_info = "{}: {} | CPU: {}".format(
         "PyPy" if "[PyPy" in sys.version else "CPython",
         sys.version.split()[0],
         get_cpu_info().get("brand_raw", "Unknown CPU"),
     )
 
-    main(sys.argv[1], system_info)
+    main(args[0], system_info)
@@ -1,10 +1,9 @@
 use minifb::{Scale, Window, WindowOptions};
-use rand::prelude::*;
 use raw_cpuid::CpuId;
 use std::env;
 use std::fs;
 use std::thread::sleep;
-use std::time::Duration;
+use std::time::{Duration, Instant};
 
 const INSTR_PER_FRAME: usize = 11;
 const FPS_TARGET: usize = 60;
@@ -13,6 +12,8 @@ const PROGRAM_START: usize = 0x200;
 const FONTSET_START: usize = 0x50;
 const SCREEN_WIDTH: usize = 64;
 const SCREEN_HEIGHT: usize = 32;
+const FNV_OFFSET: u64 = 0xCBF29CE484222325;
+const FNV_PRIME: u64 = 0x100000001B3;
 
 struct Chip8 {
     memory: [u8; MEMORY_SIZE],
@@ -26,13 +27,13 @@ struct Chip8 {
     i: usize,
     delay_timer: u8,
     sound_timer: u8,
-    window: Window,
-    rng: ThreadRng,
+    window: Option<Window>, // None in --trace and --cycles runs
+    rng_state: u64,
 }
 
 impl Chip8 {
-    fn new(filename: &str) -> Self {
-        Chip8 {
+    fn new(filename: &str, headless: bool, seed: u64) -> Self {
+        let mut chip8 = Chip8 {
             memory: Self::_init_memory(filename),
             gfx: [0; SCREEN_WIDTH * SCREEN_HEIGHT],
             screen_buffer: [0; SCREEN_WIDTH * SCREEN_HEIGHT],
@@ -44,18 +45,46 @@ impl Chip8 {
             i: 0,
             delay_timer: 0,
             sound_timer: 0,
-            rng: rand::rng(),
-            window: Window::new(
-                "Rusty8",
-                SCREEN_WIDTH,
-                SCREEN_HEIGHT,
-                WindowOptions {
-                    scale: Scale::X16,
-                    ..WindowOptions::default()
-                },
-            )
-            .unwrap(),
+            rng_state: 0,
+            window: None,
+        };
+        chip8.seed(seed);
+
+        if !headless {
+            chip8.window = Some(
+                Window::new(
+                    "Rusty8",
+                    SCREEN_WIDTH,
+                    SCREEN_HEIGHT,
+                    WindowOptions {
+                        scale: Scale::X16,
+                        ..WindowOptions::default()
+                    },
+                )
+                .unwrap(),
+            );
         }
+
+        chip8
+    }
+
+    // same generator as sea8 (splitmix64 seeding, xorshift64*), so traces
+    // with the same seed can be compared
+    fn seed(&mut self, seed: u64) {
+        let mut z = seed.wrapping_add(0x9E3779B97F4A7C15);
+        z = (z ^ (z >> 30)).wrapping_mul(0xBF58476D1CE4E5B9);
+        z = (z ^ (z >> 27)).wrapping_mul(0x94D049BB133111EB);
+        z ^= z >> 31;
+        self.rng_state = if z != 0 { z } else { 1 };
+    }
+
+    fn random_byte(&mut self) -> u8 {
+        let mut x = self.rng_state;
+        x ^= x >> 12;
+        x ^= x << 25;
+        x ^= x >> 27;
+        self.rng_state = x;
+        (x.wrapping_mul(0x2545F4914F6CDD1D) >> 56) as u8
     }
 
     fn _init_memory(filename: &str) -> [u8; MEMORY_SIZE] {
@@ -95,25 +124,34 @@ impl Chip8 {
     fn handle_input(&mut self) {
         self.prev_keys.copy_from_slice(&self.keys);
 
-        self.keys[0x1] = self.window.is_key_down(minifb::Key::Key1);
-        self.keys[0x2] = self.window.is_key_down(minifb::Key::Key2);
-        self.keys[0x3] = self.window.is_key_down(minifb::Key::Key3);
-        self.keys[0xC] = self.window.is_key_down(minifb::Key::Key4);
-
-        self.keys[0x4] = self.window.is_key_down(minifb::Key::Q);
-        self.keys[0x5] = self.window.is_key_down(minifb::Key::W);
-        self.keys[0x6] = self.window.is_key_down(minifb::Key::E);
-        self.keys[0xD] = self.window.is_key_down(minifb::Key::R);
-
-        self.keys[0x7] = self.window.is_key_down(minifb::Key::A);
-        self.keys[0x8] = self.window.is_key_down(minifb::Key::S);
-        self.keys[0x9] = self.window.is_key_down(minifb::Key::D);
-        self.keys[0xE] = self.window.is_key_down(minifb::Key::F);
-
-        self.keys[0xA] = self.window.is_key_down(minifb::Key::Z);
-        self.keys[0x0] = self.window.is_key_down(minifb::Key::X);
-        self.keys[0xB] = self.window.is_key_down(minifb::Key::C);
-        self.keys[0xF] = self.window.is_key_down(minifb::Key::V);
+        let Some(window) = &self.window else { return };
+        self.keys[0x1] = window.is_key_down(minifb::Key::Key1);
+        self.keys[0x2] = window.is_key_down(minifb::Key::Key2);
+        self.keys[0x3] = window.is_key_down(minifb::Key::Key3);
+        self.keys[0xC] = window.is_key_down(minifb::Key::Key4);
+
+        self.keys[0x4] = window.is_key_down(minifb::Key::Q);
+        self.keys[0x5] = window.is_key_down(minifb::Key::W);
+        self.keys[0x6] = window.is_key_down(minifb::Key::E);
+        self.keys[0xD] = window.is_key_down(minifb::Key::R);
+
+        self.keys[0x7] = window.is_key_down(minifb::Key::A);
+        self.keys[0x8] = window.is_key_down(minifb::Key::S);
+        self.keys[0x9] = window.is_key_down(minifb::Key::D);
+        self.keys[0xE] = window.is_key_down(minifb::Key::F);
+
+        self.keys[0xA] = window.is_key_down(minifb::Key::Z);
+        self.keys[0x0] = window.is_key_down(minifb::Key::X);
+        self.keys[0xB] = window.is_key_down(minifb::Key::C);
+        self.keys[0xF] = window.is_key_down(minifb::Key::V);
+    }
+
+    // headless input, bit k of key_mask is key k
+    fn set_keys(&mut self, key_mask: u16) {
+        self.prev_keys.copy_from_slice(&self.keys);
+        for (k, key) in self.keys.iter_mut().enumerate() {
+            *key = (key_mask >> k) & 1 != 0;
+        }
     }
 
     fn update_timers(&mut self) {
@@ -126,9 +164,25 @@ impl Chip8 {
             self.screen_buffer[i] = if pixel == 0 { 0x000000 } else { 0xFFA500 };
         }
 
-        self.window
-            .update_with_buffer(&self.screen_buffer, SCREEN_WIDTH, SCREEN_HEIGHT)
-            .unwrap();
+        if let Some(window) = &mut self.window {
+            window
+                .update_with_buffer(&self.screen_buffer, SCREEN_WIDTH, SCREEN_HEIGHT)
+                .unwrap();
+        }
+    }
+
+    // same format as sea8 --trace: frame pc I V0..VF delay_timer gfx,
+    // gfx is the FNV-1a hash of one byte per pixel
+    fn trace_line(&self, frame: u64) -> String {
+        let gfx_hash = self
+            .gfx
+            .iter()
+            .fold(FNV_OFFSET, |hash, &pixel| (hash ^ pixel as u64).wrapping_mul(FNV_PRIME));
+        let registers: String = self.v.iter().map(|r| format!("{:02x}", r)).collect();
+        format!(
+            "{} {:03x} {:03x} {} {:02x} {:016x}",
+            frame, self.pc, self.i, registers, self.delay_timer, gfx_hash
+        )
     }
 
     #[inline(always)]
@@ -327,7 +381,7 @@ impl Chip8 {
                 // opcode 0xCXNN, set VX to random byte AND NN
                 0xC000 => {
                     self.v[((opcode & 0x0F00) >> 8) as usize] =
-                        self.rng.random::<u8>() & (opcode & 0x00FF) as u8
+                        self.random_byte() & (opcode & 0x00FF) as u8
                 }
 
                 0xE000 => match opcode & 0x00FF {
@@ -413,13 +467,118 @@ impl Chip8 {
     }
 }
 
+// one "FRAME KEYS" pair per line, KEYS a hex mask held from that frame on,
+// # starts a comment
+fn load_key_script(path: &str) -> Vec<(u64, u16)> {
+    let text = fs::read_to_string(path).unwrap_or_else(|_| {
+        eprintln!("Failed to open key script: {path}");
+        std::process::exit(1);
+    });
+    let mut script: Vec<(u64, u16)> = Vec::new();
+
+    for (line_no, line) in text.lines().enumerate() {
+        let fields: Vec<&str> = line.split('#').next().unwrap().split_whitespace().collect();
+        if fields.is_empty() {
+            continue;
+        }
+        let frame = fields[0].parse::<u64>();
+        let keys = fields.get(1).map(|keys| u16::from_str_radix(keys, 16));
+        match (frame, keys) {
+            (Ok(frame), Some(Ok(keys))) if script.last().is_none_or(|last| last.0 <= frame) => {
+                script.push((frame, keys))
+            }
+            _ => {
+                eprintln!("Bad key script line {}: {path}", line_no + 1);
+                std::process::exit(1);
+            }
+        }
+    }
+
+    script
+}
+
+// one state line per frame: apply the key script, tick the timers,
+// run 11 instructions (see sea8 --trace)
+fn run_trace(filename: &str, frames: u64, seed: u64, script: &[(u64, u16)]) {
+    let mut interpreter = Chip8::new(filename, true, seed);
+    let mut keys = 0;
+    let mut pos = 0;
+
+    for frame in 0..frames {
+        while pos < script.len() && script[pos].0 <= frame {
+            keys = script[pos].1;
+            pos += 1;
+        }
+        interpreter.set_keys(keys);
+        interpreter.update_timers();
+        interpreter.emulate_instruction(INSTR_PER_FRAME);
+        println!("{}", interpreter.trace_line(frame));
+    }
+}
+
+fn run_benchmark(filename: &str, cycles: u64, seed: u64) {
+    let mut interpreter = Chip8::new(filename, true, seed);
+
+    let start_time = Instant::now();
+    for _ in 0..cycles / INSTR_PER_FRAME as u64 {
+        interpreter.update_timers();
+        interpreter.emulate_instruction(INSTR_PER_FRAME);
+    }
+    interpreter.emulate_instruction((cycles % INSTR_PER_FRAME as u64) as usize);
+    let elapsed = start_time.elapsed().as_secs_f64();
+
+    println!("engine:       rusty8");
+    println!("instructions: {}", cycles);
+    println!("wall time:    {:.6} s", elapsed);
+    println!(
+        "instr/sec:    {:.0} ({:.2} MIPS)",
+        cycles as f64 / elapsed,
+        cycles as f64 / elapsed / 1e6
+    );
+}
+
 fn main() {
     let args: Vec<String> = env::args().collect();
+    let usage = format!(
+        "Usage: {} [--trace FRAMES [--keys FILE] | --cycles N] [--seed N] <rom_file>",
+        args[0]
+    );
 
-    if args.len() != 2 {
-        println!("Usage: {} <rom_file>", args[0]);
+    let mut trace_frames = None;
+    let mut cycles = None;
+    let mut seed = None;
+    let mut key_path = None;
+    let mut pos = 1;
+    while pos + 1 < args.len() && args[pos].starts_with("--") {
+        let value = &args[pos + 1];
+        match args[pos].as_str() {
+            "--trace" => trace_frames = value.parse::<u64>().ok(),
+            "--cycles" => cycles = value.parse::<u64>().ok(),
+            "--seed" => seed = value.parse::<u64>().ok(),
+            "--keys" => key_path = Some(value.clone()),
+            _ => {
+                println!("{usage}");
+                std::process::exit(1);
+            }
+        }
+        pos += 2;
+    }
+
+    if pos + 1 != args.len() {
+        println!("{usage}");
         std::process::exit(1);
     }
+    let filename = &args[pos];
+
+    if let Some(frames) = trace_frames {
+        let script = key_path.map_or_else(Vec::new, |path| load_key_script(&path));
+        run_trace(filename, frames, seed.unwrap_or(0), &script);
+        return;
+    }
+    if let Some(cycles) = cycles {
+        run_benchmark(filename, cycles, seed.unwrap_or(0));
+        return;
+    }
 
     let system_info = format!(
         "CPU: {}",
@@ -429,13 +588,13 @@ fn main() {
             .map_or_else(|| "n/a", |pbs| pbs.as_str())
     );
 
-    let mut interpreter = Chip8::new(&args[1]);
+    let mut interpreter = Chip8::new(filename, false, seed.unwrap_or_else(rand::random));
 
     let frame_time_target: Duration = Duration::from_secs_f64(1.0 / FPS_TARGET as f64);
-    let mut last_title_update = std::time::Instant::now();
+    let mut last_title_update = Instant::now();
 
-    while interpreter.window.is_open() {
-        let start_time = std::time::Instant::now();
+    while interpreter.window.as_ref().unwrap().is_open() {
+        let start_time = Instant::now();
 
         interpreter.handle_input();
         interpreter.update_timers();
@@ -448,7 +607,7 @@ fn main() {
             sleep(sleep_time);
         }
 
-        let current_time = std::time::Instant::now();
+        let current_time = Instant::now();
         if current_time.duration_since(last_title_update) >= Duration::from_secs(2) {
             let real_fps = 1.0 / (frame_time + sleep_time).as_secs_f64();
             let status = format!(
@@ -457,7 +616,7 @@ fn main() {
                 (INSTR_PER_FRAME as f64 * real_fps) / 1000000.0,
                 system_info
             );
-            interpreter.window.set_title(&status);
+            interpreter.window.as_mut().unwrap().set_title(&status);
             println!("{status}");
             last_title_update = current_time;
         }
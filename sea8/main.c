@@ -1,611 +1,1829 @@
-#include <stdint.h>
-#include <stdio.h>
+#include "sea8.h"
+
+#include <math.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 
+#ifndef SEA8_HEADLESS
 #include "raylib.h"
+#elif defined(_WIN32)
+// the streaming server is headless only, winsock2.h clashes with Raylib
+#include <winsock2.h>
+#else
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
 
-#define INSTR_PER_FRAME 11
-#define MEM_SIZE 4096
-#define PROGRAM_START 0x200
-#define FONTSET_START 0x50
-#define STACK_SIZE 16
-#define KEY_COUNT 16
-#define REGISTER_COUNT 16
-#define SCREEN_WIDTH 64
-#define SCREEN_HEIGHT 32
 #define SCREEN_SCALE 15
+#define DEFAULT_BENCH_CYCLES 100000000ULL
+#define TIMER_HZ 60
+#define DEFAULT_IPS (SEA8_INSTR_PER_FRAME * TIMER_HZ) // same speed as the old frame locked loop
+#define MAX_IPS 1000000000ULL
+#define CATCHUP_MAX_SECONDS 0.25 // after a longer stall the scheduler drops the backlog
+#define UNLIMITED_SLICE 65536 // instructions between clock checks when the rate is unlimited
+#define DEFAULT_TURBO_SPEED 10.0
+#define STATS_WINDOW 256 // samples kept per phase for min/avg/p99
+#define STATS_INTERVAL 2.0 // seconds between title bar and stats file updates
+#define KEY_LOG_SIZE 4096 // recorded key events buffered between two drains
+#define KEY_LOG_MAGIC "sea8 key log 1"
+#define AUDIO_SAMPLE_RATE 48000
+#define DEFAULT_AUDIO_BUFFER 192 // frames per buffer, 4 ms at 48 kHz
+#define BEEPER_HZ 440
+#define BEEPER_VOLUME 6000
+#define BEEPER_ON 1
+#define BEEPER_PATTERN 2
+#define SERVE_MAX_SESSIONS 1024
+#define SERVE_BACKLOG 64
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// stack data structure
+// miscellaneous functions
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-struct Stack {
-    size_t data[STACK_SIZE];
-    size_t ptr;
-};
-
-void stack_init(struct Stack* stack)
+double get_time_seconds(void)
 {
-    stack->ptr = 0;
-    memset(stack->data, 0, sizeof(stack->data));
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
 }
 
-void stack_push(struct Stack* stack, size_t value)
+void chip8_init(struct Sea8Machine* chip8, const char* rom_path, uint64_t seed)
 {
-    if (stack->ptr >= STACK_SIZE) {
-        printf("Stack overflow\n");
+    // one-off machine, batches keep the struct Sea8Rom around instead
+    struct Sea8Rom rom;
+    int error = sea8_rom_load(&rom, rom_path);
+    if (error != SEA8_OK) {
+        printf("%s: %s\n", sea8_error_string(error), rom_path);
         exit(1);
     }
-    stack->data[stack->ptr++] = value;
+    sea8_init_rom(chip8, &rom, seed);
+    sea8_rom_free(&rom);
 }
 
-size_t stack_pop(struct Stack* stack)
+void report_unknown_opcodes(const struct Sea8Machine* c8, uint32_t* reported)
 {
-    if (stack->ptr == 0) {
-        printf("Stack underflow\n");
-        exit(1);
+    // the machine skips unknown opcodes and only counts them, print the ones
+    // since the last call (*reported is the count then)
+    uint32_t count = c8->unknown_opcodes - *reported;
+    if (count == 1) {
+        printf("Unknown opcode: 0x%04X at 0x%03X\n", c8->unknown_opcode, c8->unknown_pc);
+    } else if (count > 1) {
+        printf("Unknown opcode: 0x%04X at 0x%03X (last of %u)\n", c8->unknown_opcode, c8->unknown_pc, count);
     }
-    return stack->data[--stack->ptr];
+    *reported = c8->unknown_opcodes;
 }
 
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// chip-8 data structure
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-
-struct Chip8 {
-    uint8_t mem[MEM_SIZE];
-    uint8_t gfx[SCREEN_WIDTH * SCREEN_HEIGHT];
-    struct Stack stack;
-    uint8_t V[REGISTER_COUNT];
-    uint8_t keys[KEY_COUNT];
-    uint8_t prev_keys[KEY_COUNT];
-    size_t pc;
-    size_t I;
-    uint8_t delay_timer;
-    uint8_t sound_timer;
-};
-
-void chip8_init(struct Chip8* chip8, const char* rom_path)
+#ifndef SEA8_HEADLESS
+uint16_t poll_key_mask(void)
 {
-    // read ROM file into mem
+    uint16_t key_mask = 0;
+
+    key_mask |= IsKeyDown(KEY_X) << 0x0;
+    key_mask |= IsKeyDown(KEY_ONE) << 0x1;
+    key_mask |= IsKeyDown(KEY_TWO) << 0x2;
+    key_mask |= IsKeyDown(KEY_THREE) << 0x3;
+    key_mask |= IsKeyDown(KEY_Q) << 0x4;
+    key_mask |= IsKeyDown(KEY_W) << 0x5;
+    key_mask |= IsKeyDown(KEY_E) << 0x6;
+    key_mask |= IsKeyDown(KEY_A) << 0x7;
+    key_mask |= IsKeyDown(KEY_S) << 0x8;
+    key_mask |= IsKeyDown(KEY_D) << 0x9;
+    key_mask |= IsKeyDown(KEY_Z) << 0xA;
+    key_mask |= IsKeyDown(KEY_C) << 0xB;
+    key_mask |= IsKeyDown(KEY_FOUR) << 0xC;
+    key_mask |= IsKeyDown(KEY_R) << 0xD;
+    key_mask |= IsKeyDown(KEY_F) << 0xE;
+    key_mask |= IsKeyDown(KEY_V) << 0xF;
+
+    return key_mask;
+}
+#endif
 
-    FILE* rom = fopen(rom_path, "rb");
-    if (!rom) {
-        printf("Failed to open ROM file");
-        exit(1);
+#ifndef SEA8_HEADLESS
+void draw_frame_to_window(Texture2D screen, const uint64_t* gfx, int hires, uint64_t dirty_rows)
+{
+    // the screen is one 128x64 texture scaled up with point filtering, 64x32
+    // mode uses its top left quarter. Only rows that changed are converted
+    // and the texture is only uploaded when one did. A mode switch clears
+    // the display, so every row of the new mode is dirty.
+    // XO-CHIP: one color per combination of the two planes
+    static const Color palette[1 << SEA8_PLANE_COUNT] = { BLACK, BEIGE, ORANGE, BROWN };
+    static Color pixels[SEA8_HIRES_HEIGHT][SEA8_HIRES_WIDTH];
+    int width = SEA8_GFX_WIDTH(hires);
+    int height = SEA8_GFX_HEIGHT(hires);
+
+    if (dirty_rows != 0) {
+        for (int y = 0; y < height; ++y) {
+            if (!(dirty_rows & (1ull << y))) {
+                continue;
+            }
+            for (int x = 0; x < width; ++x) {
+                pixels[y][x] = palette[sea8_gfx_pixel(gfx, x, y)];
+            }
+        }
+        UpdateTexture(screen, pixels);
     }
 
-    fseek(rom, 0, SEEK_END);
-    long rom_size = ftell(rom);
-    fseek(rom, 0, SEEK_SET);
+    DrawTexturePro(screen,
+        (Rectangle) { 0, 0, width, height },
+        (Rectangle) { 0, 0, SEA8_SCREEN_WIDTH * SCREEN_SCALE, SEA8_SCREEN_HEIGHT * SCREEN_SCALE },
+        (Vector2) { 0, 0 }, 0, WHITE);
+}
+#endif
 
-    if (rom_size > (MEM_SIZE - PROGRAM_START)) {
-        printf("ROM file is too large to fit in mem");
-        exit(1);
-    }
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// phase statistics
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Wall time of each phase of the window loop, the last STATS_WINDOW samples
+// per phase. emu and idle are the emulation thread running and waiting,
+// render is building the frame on the render thread and present is
+// EndDrawing (buffer swap, vsync and the frame cap).
+
+enum Phase {
+    PHASE_EMU,
+    PHASE_IDLE,
+    PHASE_RENDER,
+    PHASE_PRESENT,
+    PHASE_COUNT
+};
+
+const char* const phase_names[PHASE_COUNT] = { "emu", "idle", "render", "present" };
 
-    fread(&chip8->mem[PROGRAM_START], 1, rom_size, rom);
-    fclose(rom);
+struct PhaseStats {
+    pthread_mutex_t lock; // samples come from both threads
+    double samples[PHASE_COUNT][STATS_WINDOW];
+    size_t count[PHASE_COUNT];
+    size_t next[PHASE_COUNT];
+};
 
-    // load fontset into mem
+struct PhaseSummary {
+    double min;
+    double avg;
+    double p99;
+};
 
-    uint8_t fontset[80] = {
-        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
-        0x20, 0x60, 0x20, 0x20, 0x70, // 1
-        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
-        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
-        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
-        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
-        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
-        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
-        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
-        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
-        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
-        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
-        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
-        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
-        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
-        0xF0, 0x80, 0xF0, 0x80, 0x80, // F
-    };
+void phase_stats_init(struct PhaseStats* stats)
+{
+    memset(stats->count, 0, sizeof(stats->count));
+    memset(stats->next, 0, sizeof(stats->next));
+    pthread_mutex_init(&stats->lock, NULL);
+}
 
-    memcpy(&chip8->mem[FONTSET_START], fontset, 80);
+void phase_stats_add(struct PhaseStats* stats, enum Phase phase, double seconds)
+{
+    pthread_mutex_lock(&stats->lock);
+    stats->samples[phase][stats->next[phase]] = seconds;
+    stats->next[phase] = (stats->next[phase] + 1) % STATS_WINDOW;
+    stats->count[phase] += stats->count[phase] < STATS_WINDOW;
+    pthread_mutex_unlock(&stats->lock);
+}
 
-    // init stack
+int compare_doubles(const void* a, const void* b)
+{
+    double x = *(const double*)a;
+    double y = *(const double*)b;
+    return (x > y) - (x < y);
+}
 
-    stack_init(&chip8->stack);
+struct PhaseSummary phase_stats_summary(struct PhaseStats* stats, enum Phase phase)
+{
+    double sorted[STATS_WINDOW];
+    pthread_mutex_lock(&stats->lock);
+    size_t n = stats->count[phase];
+    memcpy(sorted, stats->samples[phase], n * sizeof(double));
+    pthread_mutex_unlock(&stats->lock);
+
+    struct PhaseSummary summary = { 0, 0, 0 };
+    if (n == 0) {
+        return summary;
+    }
 
-    // init other arrays
+    qsort(sorted, n, sizeof(double), compare_doubles);
+    double sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += sorted[i];
+    }
+    summary.min = sorted[0];
+    summary.avg = sum / n;
+    summary.p99 = sorted[(n * 99 + 99) / 100 - 1];
+    return summary;
+}
 
-    memset(chip8->gfx, 0, sizeof(chip8->gfx));
-    memset(chip8->V, 0, sizeof(chip8->V));
-    memset(chip8->keys, 0, sizeof(chip8->keys));
-    memset(chip8->prev_keys, 0, sizeof(chip8->prev_keys));
+void write_stats(FILE* out, int json, double time, uint64_t instructions, double ips,
+    double speedup, const struct PhaseSummary* phases)
+{
+    // one line per call, CSV after a header line or one JSON object per line
+    // (times in milliseconds)
+    if (json) {
+        fprintf(out, "{\"time\":%.3f,\"instructions\":%llu,\"ips\":%.0f,\"speedup\":%.3f",
+            time, (unsigned long long)instructions, ips, speedup);
+        for (int p = 0; p < PHASE_COUNT; ++p) {
+            fprintf(out, ",\"%s\":{\"min\":%.4f,\"avg\":%.4f,\"p99\":%.4f}", phase_names[p],
+                phases[p].min * 1000, phases[p].avg * 1000, phases[p].p99 * 1000);
+        }
+        fprintf(out, "}\n");
+    } else {
+        fprintf(out, "%.3f,%llu,%.0f,%.3f", time, (unsigned long long)instructions, ips, speedup);
+        for (int p = 0; p < PHASE_COUNT; ++p) {
+            fprintf(out, ",%.4f,%.4f,%.4f", phases[p].min * 1000, phases[p].avg * 1000, phases[p].p99 * 1000);
+        }
+        fprintf(out, "\n");
+    }
+    fflush(out);
+}
 
-    // init other variables
+void write_stats_header(FILE* out)
+{
+    fprintf(out, "time_s,instructions,ips,speedup");
+    for (int p = 0; p < PHASE_COUNT; ++p) {
+        fprintf(out, ",%s_min_ms,%s_avg_ms,%s_p99_ms", phase_names[p], phase_names[p], phase_names[p]);
+    }
+    fprintf(out, "\n");
+}
 
-    chip8->pc = PROGRAM_START;
-    chip8->I = 0;
-    chip8->delay_timer = 0;
-    chip8->sound_timer = 0;
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// input recording
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-    // seed random number generator
+// --record FILE logs every sea8_set_keys call that changes the machine
+// (a new mask, and the call after it that catches prev_keys up) as the
+// scheduler's instruction count and the mask. With the seed, the rate and
+// the timer ticks at fixed instruction counts that is all --replay needs to
+// rerun the session exactly. The emulation thread only fills a fixed ring,
+// the render thread drains it to the file every frame, so recording does
+// not allocate, lock or touch the disk on the emulation thread.
+//
+// The file is text: the KEY_LOG_MAGIC line, "seed N", "ips N", "quirks
+// PROFILE", one "INSTRUCTION KEYS" line per event and "end INSTRUCTIONS
+// CHECKSUM" with the state hash when the recording stopped.
+
+struct KeyLog {
+    struct Sea8KeyEvent events[KEY_LOG_SIZE];
+    atomic_size_t head; // next event to write, emulation thread
+    atomic_size_t tail; // next event to drain, render thread
+    atomic_int overflow; // an event was dropped, the log is incomplete
+
+    // emulation thread only
+    uint16_t keys; // last mask applied
+    int edge; // the last call changed the mask, the next one changes prev_keys
+    int finished;
+    uint64_t end_instructions;
+    uint64_t end_hash;
+};
 
-    srand(time(NULL));
+void key_log_init(struct KeyLog* log)
+{
+    atomic_init(&log->head, 0);
+    atomic_init(&log->tail, 0);
+    atomic_init(&log->overflow, 0);
+    log->keys = 0; // chip8_init clears the keys
+    log->edge = 0;
+    log->finished = 0;
+    log->end_instructions = 0;
+    log->end_hash = 0;
 }
 
-void chip8_handle_input(struct Chip8* chip8)
+void key_log_record(struct KeyLog* log, uint64_t instructions, uint16_t key_mask)
 {
-    memcpy(chip8->prev_keys, chip8->keys, sizeof(chip8->keys));
+    // called right before sea8_set_keys, skips the calls that change nothing
+    if (log->finished || (key_mask == log->keys && !log->edge)) {
+        return;
+    }
+    log->edge = key_mask != log->keys;
+    log->keys = key_mask;
 
-    chip8->keys[0x0] = IsKeyDown(KEY_X);
-    chip8->keys[0x1] = IsKeyDown(KEY_ONE);
-    chip8->keys[0x2] = IsKeyDown(KEY_TWO);
-    chip8->keys[0x3] = IsKeyDown(KEY_THREE);
-    chip8->keys[0x4] = IsKeyDown(KEY_Q);
-    chip8->keys[0x5] = IsKeyDown(KEY_W);
-    chip8->keys[0x6] = IsKeyDown(KEY_E);
-    chip8->keys[0x7] = IsKeyDown(KEY_A);
-    chip8->keys[0x8] = IsKeyDown(KEY_S);
-    chip8->keys[0x9] = IsKeyDown(KEY_D);
-    chip8->keys[0xA] = IsKeyDown(KEY_Z);
-    chip8->keys[0xB] = IsKeyDown(KEY_C);
-    chip8->keys[0xC] = IsKeyDown(KEY_FOUR);
-    chip8->keys[0xD] = IsKeyDown(KEY_R);
-    chip8->keys[0xE] = IsKeyDown(KEY_F);
-    chip8->keys[0xF] = IsKeyDown(KEY_V);
+    size_t head = atomic_load(&log->head);
+    if (head - atomic_load(&log->tail) == KEY_LOG_SIZE) {
+        atomic_store(&log->overflow, 1);
+        return;
+    }
+    log->events[head % KEY_LOG_SIZE] = (struct Sea8KeyEvent) { instructions, key_mask };
+    atomic_store(&log->head, head + 1);
 }
 
-void chip8_update_timers(struct Chip8* chip8)
+void key_log_finish(struct KeyLog* log, uint64_t instructions, const struct Sea8Machine* c8)
 {
-    if (chip8->delay_timer > 0) {
-        chip8->delay_timer--;
-    }
-    if (chip8->sound_timer > 0) {
-        chip8->sound_timer--;
+    // the end of the session, or a loaded state the log cannot reproduce
+    if (!log->finished) {
+        log->finished = 1;
+        log->end_instructions = instructions;
+        log->end_hash = sea8_state_hash(c8);
     }
 }
 
-void chip8_draw_sprite(struct Chip8* c8, uint8_t x, uint8_t y, uint8_t n)
+void key_log_drain(struct KeyLog* log, FILE* out)
 {
-    c8->V[0xF] = 0;
+    size_t tail = atomic_load(&log->tail);
+    size_t head = atomic_load(&log->head);
+    for (; tail != head; ++tail) {
+        const struct Sea8KeyEvent* event = &log->events[tail % KEY_LOG_SIZE];
+        fprintf(out, "%llu %04x\n", (unsigned long long)event->cycle, event->keys);
+    }
+    atomic_store(&log->tail, tail);
+}
 
-    uint8_t max_rows = n < SCREEN_HEIGHT - y ? n : SCREEN_HEIGHT - y; // mostly 1
-    uint8_t max_cols = 8 < SCREEN_WIDTH - x ? 8 : SCREEN_WIDTH - x; // mostly 8
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// audio
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-    if (max_rows == 1 && max_cols == 8) {
+// The beeper is generated in Raylib's audio callback, on the audio device's
+// thread. The emulation thread publishes what it should play after every
+// scheduler step as plain atomic stores and the callback only loads them,
+// so neither side ever waits for the other. A pattern read half old and
+// half new is one buffer of slightly wrong noise, not worth a lock.
+//
+// CHIP-8 and SCHIP play a square wave while the sound timer runs. XO-CHIP
+// plays the 128 bit audio pattern at its pitch instead, once a ROM loaded
+// one with F002 (until then the pattern is all zero and the square wave
+// stands in, as in Octo).
+
+#ifndef SEA8_HEADLESS
+struct Beeper {
+    atomic_uint tone; // BEEPER_ON | BEEPER_PATTERN | pitch << 8
+    atomic_uint_fast64_t pattern[SEA8_AUDIO_PATTERN_SIZE / 8]; // big endian, bit 63 of word 0 plays first
+
+    // audio thread only
+    double phase; // square wave cycles, or pattern bits, played so far
+};
 
-        // no row loop and explicit range (0..8) for better compiler optimization
-        size_t y_coord = y * SCREEN_WIDTH + x;
-        uint8_t sprite_byte = c8->mem[c8->I];
+void beeper_init(struct Beeper* beeper)
+{
+    atomic_init(&beeper->tone, 0);
+    for (int w = 0; w < SEA8_AUDIO_PATTERN_SIZE / 8; ++w) {
+        atomic_init(&beeper->pattern[w], 0);
+    }
+    beeper->phase = 0;
+}
 
-        for (uint8_t bit = 0; bit < 8; ++bit) {
-            if (sprite_byte & (0x80 >> bit)) {
-                if (c8->V[0xF] == 0) {
-                    c8->V[0xF] |= c8->gfx[y_coord + bit];
-                }
-                c8->gfx[y_coord + bit] ^= 1;
-            }
-        }
+void beeper_publish(struct Beeper* beeper, const struct Sea8Machine* c8)
+{
+    // emulation thread, after every scheduler step
+    uint64_t words[SEA8_AUDIO_PATTERN_SIZE / 8] = { 0 };
+    for (int b = 0; b < SEA8_AUDIO_PATTERN_SIZE; ++b) {
+        words[b / 8] |= (uint64_t)c8->audio_pattern[b] << (56 - 8 * (b % 8));
+    }
 
-    } else {
+    unsigned tone = c8->sound_timer > 0 ? BEEPER_ON : 0;
+    if (c8->quirks == SEA8_QUIRKS_XOCHIP && (words[0] | words[1])) {
+        tone |= BEEPER_PATTERN | (unsigned)c8->pitch << 8;
+        atomic_store(&beeper->pattern[0], words[0]);
+        atomic_store(&beeper->pattern[1], words[1]);
+    }
+    atomic_store(&beeper->tone, tone);
+}
 
-        // as above, but not unrolled and max_cols unknown at compile time
-        for (uint8_t row = 0; row < max_rows; ++row) {
-            size_t y_coord = (y + row) * SCREEN_WIDTH + x;
-            uint8_t sprite_byte = c8->mem[c8->I + row];
+void beeper_fill(struct Beeper* beeper, int16_t* samples, unsigned frames)
+{
+    // audio thread, one mono buffer of AUDIO_SAMPLE_RATE samples
+    unsigned tone = atomic_load(&beeper->tone);
+    if (!(tone & BEEPER_ON)) {
+        memset(samples, 0, frames * sizeof(*samples));
+        beeper->phase = 0; // every beep starts on the same edge
+        return;
+    }
 
-            for (uint8_t bit = 0; bit < max_cols; ++bit) {
-                if (sprite_byte & (0x80 >> bit)) {
-                    c8->V[0xF] |= c8->gfx[y_coord + bit];
-                    c8->gfx[y_coord + bit] ^= 1;
-                }
-            }
+    if (tone & BEEPER_PATTERN) {
+        uint64_t words[SEA8_AUDIO_PATTERN_SIZE / 8] = { atomic_load(&beeper->pattern[0]), atomic_load(&beeper->pattern[1]) };
+        double step = 4000.0 * pow(2.0, ((int)(tone >> 8) - 64) / 48.0) / AUDIO_SAMPLE_RATE;
+        for (unsigned f = 0; f < frames; ++f) {
+            unsigned bit = (unsigned)beeper->phase % (SEA8_AUDIO_PATTERN_SIZE * 8);
+            samples[f] = (words[bit / 64] >> (63 - bit % 64)) & 1 ? BEEPER_VOLUME : -BEEPER_VOLUME;
+            beeper->phase = fmod(beeper->phase + step, SEA8_AUDIO_PATTERN_SIZE * 8);
+        }
+    } else {
+        double step = (double)BEEPER_HZ / AUDIO_SAMPLE_RATE;
+        for (unsigned f = 0; f < frames; ++f) {
+            samples[f] = beeper->phase < 0.5 ? BEEPER_VOLUME : -BEEPER_VOLUME;
+            beeper->phase += step;
+            beeper->phase -= beeper->phase >= 1.0;
         }
     }
 }
 
-void chip8_emulate_instructions(struct Chip8* c8, int instr_count)
-{
-    for (int i = 0; i < instr_count; i++) {
-        uint16_t opcode = (c8->mem[c8->pc] << 8) | c8->mem[c8->pc + 1];
-        c8->pc += 2;
+// Raylib's callback has no user pointer, so the window's one beeper lives
+// here
+struct Beeper window_beeper;
 
-        switch (opcode & 0xF000) {
+void beeper_callback(void* buffer, unsigned int frames)
+{
+    beeper_fill(&window_beeper, buffer, frames);
+}
 
-        case 0x7000:
+int beeper_open(AudioStream* stream, int buffer_frames)
+{
+    // 0 without an audio device, the emulator then runs silent. Raylib
+    // double buffers the stream, so the latency is about two buffers.
+    beeper_init(&window_beeper);
+    InitAudioDevice();
+    if (!IsAudioDeviceReady()) {
+        printf("No audio device, running without sound\n");
+        return 0;
+    }
+    SetAudioStreamBufferSizeDefault(buffer_frames);
+    *stream = LoadAudioStream(AUDIO_SAMPLE_RATE, 16, 1);
+    SetAudioStreamCallback(*stream, beeper_callback);
+    PlayAudioStream(*stream);
+    return 1;
+}
 
-            // opcode 0x7XNN, add NN to register VX
-            c8->V[(opcode & 0x0F00) >> 8] += opcode & 0x00FF;
-            break;
+void beeper_close(AudioStream stream)
+{
+    UnloadAudioStream(stream);
+    CloseAudioDevice();
+}
+#endif
 
-        case 0x4000:
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// emulation thread
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-            // opcode 0x4XNN, skip next instruction if VX != NN
-            if (c8->V[(opcode & 0x0F00) >> 8] != (opcode & 0x00FF)) {
-                c8->pc += 2;
-            }
-            break;
+// In the window the machine runs on its own thread, paced by the scheduler
+// below, and the render thread only presents, so a slow present or a vsync stall
+// does not hold back emulation. Finished framebuffers go to the render
+// thread through a triple buffer, keys and hotkeys come back as atomics.
 
-        case 0xD000:
+#define FRAME_FRESH 4 // set in TripleBuffer.middle when it holds an unread frame
 
-            // opcode 0xDXYN, draw sprite at coordinate (VX, VY) with height N
-            chip8_draw_sprite(
-                c8,
-                c8->V[(opcode & 0x0F00) >> 8] & (SCREEN_WIDTH - 1),
-                c8->V[(opcode & 0x00F0) >> 4] & (SCREEN_HEIGHT - 1),
-                opcode & 0x000F);
-            break;
+struct Frame {
+    uint64_t gfx[SEA8_GFX_SIZE];
+    uint8_t hires;
+    uint64_t dirty_rows; // rows changed since the last frame the reader took
+};
 
-        case 0x1000:
+struct TripleBuffer {
+    struct Frame frames[3];
+    int back; // writer only
+    uint64_t pending_rows; // writer only, rows of published frames the reader may not have seen
+    int front; // reader only
+    atomic_int middle; // index of the spare frame, plus FRAME_FRESH
+};
 
-            // opcode 0x1NNN, jump to address NNN
-            c8->pc = opcode & 0x0FFF;
-            break;
+void triple_buffer_init(struct TripleBuffer* tb)
+{
+    memset(tb->frames, 0, sizeof(tb->frames));
+    tb->back = 0;
+    tb->pending_rows = 0;
+    tb->front = 1;
+    atomic_init(&tb->middle, 2);
+}
 
-        case 0x2000:
+void triple_buffer_publish(struct TripleBuffer* tb, const struct Sea8Machine* c8)
+{
+    struct Frame* frame = &tb->frames[tb->back];
+    memcpy(frame->gfx, c8->gfx, sizeof(frame->gfx));
+    frame->hires = c8->hires;
+    frame->dirty_rows = c8->dirty_rows | tb->pending_rows;
 
-            // opcode 0x2NNN, call subroutine at address NNN
-            stack_push(&c8->stack, c8->pc);
-            c8->pc = opcode & 0x0FFF;
-            break;
+    int prev = atomic_exchange(&tb->middle, tb->back | FRAME_FRESH);
+    tb->back = prev & 3;
 
-        case 0x3000:
+    // when the frame we got back was never read, its rows are only in the
+    // one just published and must stay pending until the reader takes one
+    tb->pending_rows = (prev & FRAME_FRESH) ? frame->dirty_rows : c8->dirty_rows;
+}
 
-            // opcode 0x3XNN, skip next instruction if VX == NN
-            if (c8->V[(opcode & 0x0F00) >> 8] == (opcode & 0x00FF)) {
-                c8->pc += 2;
-            }
-            break;
+const struct Frame* triple_buffer_acquire(struct TripleBuffer* tb, int* fresh)
+{
+    // returns the newest frame, fresh = 0 when it was already returned before
+    *fresh = (atomic_load(&tb->middle) & FRAME_FRESH) != 0;
+    if (*fresh) {
+        tb->front = atomic_exchange(&tb->middle, tb->front) & 3;
+    }
+    return &tb->frames[tb->front];
+}
 
-        case 0x5000:
+// The scheduler runs the machine at a target instruction rate. Emulated
+// time is counted in instructions: timer tick k happens when instruction
+// k * ips / 60 is reached, so the timers run at exactly 60 Hz of emulated
+// time whatever the host frame rate is, and rounding never accumulates.
+// Emulated time follows host time from `start`; after a hiccup the backlog
+// is run in one burst, capped to CATCHUP_MAX_SECONDS. With ips = 0 the
+// machine runs flat out and the timers follow host time instead.
+//
+// Turbo multiplies the emulated time per host second by `speed` (0 = as
+// fast as possible). Timers still tick in emulated time, so a game runs
+// exactly as it would at speed 1, only sooner.
+
+struct Scheduler {
+    uint64_t ips; // 0 = unlimited
+    double speed; // emulated seconds per host second, 0 = as fast as possible
+    uint64_t instructions; // executed so far
+    uint64_t timer_ticks; // 60 Hz ticks so far
+    double start; // host time at which instruction 0 was due at this speed
+};
 
-            // opcode 0x5XY0, skip next instruction if VX == VY
-            if (c8->V[(opcode & 0x0F00) >> 8] == c8->V[(opcode & 0x00F0) >> 4]) {
-                c8->pc += 2;
-            }
-            break;
+void scheduler_init(struct Scheduler* sched, uint64_t ips, double now)
+{
+    sched->ips = ips;
+    sched->speed = 1.0;
+    sched->instructions = 0;
+    sched->timer_ticks = 0;
+    sched->start = now;
+}
 
-        case 0x6000:
+void scheduler_set_speed(struct Scheduler* sched, double speed, double now)
+{
+    // re-anchor so the instructions executed so far are exactly due now
+    sched->speed = speed;
+    if (sched->ips != 0 && speed > 0) {
+        sched->start = now - (double)sched->instructions / (sched->ips * speed);
+    }
+}
 
-            // opcode 0x6XNN, set register VX to NN
-            c8->V[(opcode & 0x0F00) >> 8] = opcode & 0x00FF;
+void scheduler_run_to(struct Scheduler* sched, struct Sea8Machine* c8, uint64_t target)
+{
+    for (;;) {
+        uint64_t next_tick = sched->timer_ticks * sched->ips / TIMER_HZ;
+        if (sched->instructions >= next_tick) {
+            sea8_update_timers(c8);
+            sched->timer_ticks++;
+            continue;
+        }
+        if (sched->instructions >= target) {
             break;
+        }
 
-        case 0x8000:
+        uint64_t end = next_tick < target ? next_tick : target;
+        while (sched->instructions < end) {
+            uint64_t count = end - sched->instructions;
+            count = count < UNLIMITED_SLICE ? count : UNLIMITED_SLICE;
+            sea8_emulate_instructions(c8, (int)count);
+            sched->instructions += count;
+        }
+    }
+}
 
-            switch (opcode & 0x000F) {
+double scheduler_update(struct Scheduler* sched, struct Sea8Machine* c8, double now)
+{
+    // runs everything that is due at host time `now` and returns the host
+    // time to come back at: the next timer tick, but at most once per host
+    // frame so turbo does not wake the thread hundreds of times a second
+
+    // running flat out, an idle loop would only burn the host core: with
+    // host timers nothing can change before the next host tick or a key
+    // edge, with emulated timers a timer poll is fast forwarded by the
+    // slices themselves and only a key wait blocks until the next frame
+
+    if (sched->ips == 0) {
+        double frame_end = now + 1.0 / TIMER_HZ;
+        do {
+            sea8_emulate_instructions(c8, UNLIMITED_SLICE);
+            sched->instructions += UNLIMITED_SLICE;
+            now = get_time_seconds();
+            uint64_t due = (uint64_t)((now - sched->start) * TIMER_HZ);
+            for (; sched->timer_ticks < due; sched->timer_ticks++) {
+                sea8_update_timers(c8);
+            }
+            if (c8->idle != SEA8_IDLE_NONE) {
+                return sched->start + (double)(sched->timer_ticks + 1) / TIMER_HZ;
+            }
+        } while (now < frame_end);
+        return now;
+    }
 
-            case 0x0000:
+    if (sched->speed == 0) {
+        double frame_end = now + 1.0 / TIMER_HZ;
+        do {
+            scheduler_run_to(sched, c8, sched->instructions + UNLIMITED_SLICE);
+            now = get_time_seconds();
+            if (c8->idle == SEA8_IDLE_INPUT) {
+                return frame_end;
+            }
+        } while (now < frame_end);
+        return now;
+    }
 
-                // opcode 0x8XY0, set VX to VY
-                c8->V[(opcode & 0x0F00) >> 8] = c8->V[(opcode & 0x00F0) >> 4];
-                break;
+    double rate = sched->ips * sched->speed;
+    double behind = now - sched->start - (double)sched->instructions / rate;
+    if (behind > CATCHUP_MAX_SECONDS) {
+        sched->start += behind - CATCHUP_MAX_SECONDS;
+    }
 
-            case 0x0001:
+    scheduler_run_to(sched, c8, (uint64_t)((now - sched->start) * rate));
 
-                // opcode 0x8XY1, set VX to VX OR VY
-                c8->V[(opcode & 0x0F00) >> 8] |= c8->V[(opcode & 0x00F0) >> 4];
-                c8->V[0xF] = 0;
-                break;
+    uint64_t next_tick = sched->timer_ticks * sched->ips / TIMER_HZ;
+    double wake = sched->start + (double)next_tick / rate;
+    double min_wake = now + 1.0 / TIMER_HZ;
+    return sched->speed > 1 && wake < min_wake ? min_wake : wake;
+}
 
-            case 0x0002:
+struct EmuThread {
+    pthread_t thread;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    struct Sea8Machine* c8;
+    const struct Sea8Machine* base;
+    uint64_t ips;
+    double turbo_speed;
+    struct TripleBuffer frames;
+    struct PhaseStats stats;
+    atomic_uint_fast64_t instructions; // c8->instructions, for the status bar
+    atomic_uint keys; // mask from poll_key_mask, written by the render thread
+    atomic_int save_request;
+    atomic_int load_request;
+    atomic_int turbo; // toggled by the render thread
+    atomic_int quit;
+    atomic_int error; // c8->error, for the status bar
+    int keys_changed; // under lock, ends the current wait early
+    struct KeyLog* log; // NULL unless --record
+    struct Beeper* beeper; // NULL without sound
+    uint8_t quicksave[SEA8_STATE_MAX_SIZE];
+    size_t quicksave_size;
+};
 
-                // opcode 0x8XY2, set VX to VX AND VY
-                c8->V[(opcode & 0x0F00) >> 8] &= c8->V[(opcode & 0x00F0) >> 4];
-                c8->V[0xF] = 0;
-                break;
+void emu_thread_set_keys(struct EmuThread* emu, uint16_t key_mask)
+{
+    // a key edge may end an idle wait, so wake the thread right away
+    if (atomic_exchange(&emu->keys, key_mask) != key_mask) {
+        pthread_mutex_lock(&emu->lock);
+        emu->keys_changed = 1;
+        pthread_cond_signal(&emu->wake);
+        pthread_mutex_unlock(&emu->lock);
+    }
+}
 
-            case 0x0003:
+void emu_thread_wait_until(struct EmuThread* emu, double deadline)
+{
+    // a timed wait instead of a sleep so emu_thread_stop wakes us at once
+    struct timespec ts;
+    ts.tv_sec = (time_t)deadline;
+    ts.tv_nsec = (long)((deadline - (double)ts.tv_sec) * 1e9);
+
+    pthread_mutex_lock(&emu->lock);
+    while (!atomic_load(&emu->quit) && !emu->keys_changed && get_time_seconds() < deadline) {
+        if (pthread_cond_timedwait(&emu->wake, &emu->lock, &ts) != 0) {
+            break;
+        }
+    }
+    emu->keys_changed = 0;
+    pthread_mutex_unlock(&emu->lock);
+}
 
-                // opcode 0x8XY3, set VX to VX XOR VY
-                c8->V[(opcode & 0x0F00) >> 8] ^= c8->V[(opcode & 0x00F0) >> 4];
-                c8->V[0xF] = 0;
-                break;
+void* emu_thread_main(void* arg)
+{
+    struct EmuThread* emu = arg;
+    struct Sea8Machine* c8 = emu->c8;
+    struct Scheduler sched;
+    scheduler_init(&sched, emu->ips, get_time_seconds());
+    int turbo = 0;
+    uint32_t unknown_reported = 0;
+
+    while (!atomic_load(&emu->quit)) {
+        // F5 saves a state into memory, F9 restores it
+        if (atomic_exchange(&emu->save_request, 0)) {
+            emu->quicksave_size = sea8_save_state(c8, emu->quicksave, sizeof(emu->quicksave));
+        }
+        if (atomic_exchange(&emu->load_request, 0) && emu->quicksave_size > 0) {
+            if (emu->log) {
+                key_log_finish(emu->log, sched.instructions, c8);
+            }
+            sea8_load_state(c8, emu->base, emu->quicksave, emu->quicksave_size);
+        }
 
-            case 0x0004:
+        if (atomic_load(&emu->turbo) != turbo) {
+            turbo = !turbo;
+            scheduler_set_speed(&sched, turbo ? emu->turbo_speed : 1.0, get_time_seconds());
+        }
 
-                // opcode 0x8XY4, add VY to VX, set VF to 1 if overflow, else 0
-                {
-                    size_t x = (opcode & 0x0F00) >> 8;
-                    size_t y = (opcode & 0x00F0) >> 4;
-                    char overflow = (c8->V[x] + c8->V[y]) > 0xFF;
-                    c8->V[x] += c8->V[y];
-                    c8->V[0xF] = overflow;
-                }
-                break;
+        double busy_start = get_time_seconds();
+        uint16_t key_mask = (uint16_t)atomic_load(&emu->keys);
+        if (emu->log) {
+            key_log_record(emu->log, sched.instructions, key_mask);
+        }
+        sea8_set_keys(c8, key_mask);
+        double wake = scheduler_update(&sched, c8, busy_start);
+        report_unknown_opcodes(c8, &unknown_reported);
+        triple_buffer_publish(&emu->frames, c8);
+        c8->dirty_rows = 0;
+#ifndef SEA8_HEADLESS
+        if (emu->beeper) {
+            beeper_publish(emu->beeper, c8);
+        }
+#endif
+        atomic_store(&emu->instructions, c8->instructions);
+        atomic_store(&emu->error, c8->error);
+
+        double idle_start = get_time_seconds();
+        emu_thread_wait_until(emu, wake);
+        phase_stats_add(&emu->stats, PHASE_EMU, idle_start - busy_start);
+        phase_stats_add(&emu->stats, PHASE_IDLE, get_time_seconds() - idle_start);
+    }
 
-            case 0x0005:
+    if (emu->log) {
+        key_log_finish(emu->log, sched.instructions, c8);
+    }
+    return NULL;
+}
 
-                // opcode 0x8XY5, set VX to VX - VY, set VF to 0 if underflow, else 1
-                {
-                    size_t x = (opcode & 0x0F00) >> 8;
-                    size_t y = (opcode & 0x00F0) >> 4;
-                    char no_underflow = c8->V[x] >= c8->V[y];
-                    c8->V[x] -= c8->V[y];
-                    c8->V[0xF] = no_underflow;
-                }
-                break;
+void emu_thread_start(struct EmuThread* emu, struct Sea8Machine* c8, const struct Sea8Machine* base, uint64_t ips,
+    double turbo_speed, int turbo, struct KeyLog* log, struct Beeper* beeper)
+{
+    emu->c8 = c8;
+    emu->log = log;
+    emu->beeper = beeper;
+    emu->base = base;
+    emu->ips = ips;
+    emu->turbo_speed = turbo_speed;
+    phase_stats_init(&emu->stats);
+    atomic_init(&emu->instructions, c8->instructions);
+    emu->quicksave_size = 0;
+    triple_buffer_init(&emu->frames);
+    atomic_init(&emu->keys, 0);
+    atomic_init(&emu->save_request, 0);
+    atomic_init(&emu->load_request, 0);
+    atomic_init(&emu->turbo, turbo);
+    atomic_init(&emu->quit, 0);
+    atomic_init(&emu->error, c8->error);
+    emu->keys_changed = 0;
+    pthread_mutex_init(&emu->lock, NULL);
+    pthread_cond_init(&emu->wake, NULL);
+
+    if (pthread_create(&emu->thread, NULL, emu_thread_main, emu) != 0) {
+        printf("Failed to start emulation thread\n");
+        exit(1);
+    }
+}
 
-            case 0x0006:
-
-                // opcode 0x8XY6, shift VX right by 1
-                // set VF to least significant bit of VX before shift
-                {
-                    size_t x = (opcode & 0x0F00) >> 8;
-                    size_t y = (opcode & 0x00F0) >> 4;
-                    c8->V[x] = c8->V[y];
-                    char overflow = c8->V[x] & 0x1;
-                    c8->V[x] >>= 1;
-                    c8->V[0xF] = overflow;
-                }
-                break;
+void emu_thread_stop(struct EmuThread* emu)
+{
+    pthread_mutex_lock(&emu->lock);
+    atomic_store(&emu->quit, 1);
+    pthread_cond_signal(&emu->wake);
+    pthread_mutex_unlock(&emu->lock);
+
+    pthread_join(emu->thread, NULL);
+    pthread_cond_destroy(&emu->wake);
+    pthread_mutex_destroy(&emu->lock);
+    pthread_mutex_destroy(&emu->stats.lock);
+}
 
-            case 0x0007:
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// headless benchmark
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-                // opcode 0x8XY7, set VX to VY - VX, set VF to 0 if underflow, else 1
-                {
-                    size_t x = (opcode & 0x0F00) >> 8;
-                    size_t y = (opcode & 0x00F0) >> 4;
-                    char no_underflow = c8->V[y] >= c8->V[x];
-                    c8->V[x] = c8->V[y] - c8->V[x];
-                    c8->V[0xF] = no_underflow;
-                }
-                break;
+void print_run_report(const struct Sea8Machine* c8, uint64_t cycles, double elapsed, uint64_t elapsed_cycles, uint64_t seed)
+{
+    printf("engine:       %s\n", sea8_engine_name);
+    printf("instructions: %llu\n", (unsigned long long)cycles);
+    printf("wall time:    %.6f s\n", elapsed);
+    printf("instr/sec:    %.0f (%.2f MIPS)\n", cycles / elapsed, cycles / elapsed / 1e6);
+    printf("cycles/instr: %.2f\n", cycles ? (double)elapsed_cycles / cycles : 0.0);
+    printf("seed:         %llu\n", (unsigned long long)seed);
+    printf("checksum:     %016llx\n", (unsigned long long)sea8_state_hash(c8));
+    if (c8->unknown_opcodes > 0) {
+        printf("unknown ops:  %u skipped, last 0x%04X at 0x%03X\n", c8->unknown_opcodes, c8->unknown_opcode,
+            c8->unknown_pc);
+    }
+    if (c8->error != SEA8_OK) {
+        printf("halted:       %s at 0x%03zX after %llu instructions\n", sea8_error_string(c8->error), c8->pc,
+            (unsigned long long)c8->instructions);
+    }
+}
 
-            case 0x000E:
-
-                // opcode 0x8XYE, set VX to VX << 1,
-                // set VF to most significant bit of VX before shift
-                {
-                    size_t x = (opcode & 0x0F00) >> 8;
-                    size_t y = (opcode & 0x00F0) >> 4;
-                    c8->V[x] = c8->V[y];
-                    char overflow = (c8->V[x] & 0x80) >> 7;
-                    c8->V[x] <<= 1;
-                    c8->V[0xF] = overflow;
-                }
-                break;
+int run_headless(struct Sea8Machine* c8, uint64_t cycles, uint64_t seed)
+{
+    // same frame structure as the window loop (timers tick every SEA8_INSTR_PER_FRAME
+    // instructions), just without input, drawing and frame cap. Returns the
+    // error the machine halted on, if any.
 
-            default:
-                printf("Unknown opcode: 0x%04X\n", opcode);
-                break;
-            }
+    double start_time = get_time_seconds();
+    uint64_t start_cycles = sea8_read_cycle_counter();
 
-            break;
+    uint64_t frames = cycles / SEA8_INSTR_PER_FRAME;
+    for (uint64_t f = 0; f < frames && c8->error == SEA8_OK; ++f) {
+        sea8_update_timers(c8);
+        sea8_emulate_instructions(c8, SEA8_INSTR_PER_FRAME);
+    }
+    sea8_emulate_instructions(c8, (int)(cycles % SEA8_INSTR_PER_FRAME));
 
-        case 0x9000:
+    print_run_report(c8, cycles, get_time_seconds() - start_time, sea8_read_cycle_counter() - start_cycles, seed);
+    return c8->error;
+}
 
-            // opcode 0x9XY0, skip next instruction if VX != VY
-            if (c8->V[(opcode & 0x0F00) >> 8] != c8->V[(opcode & 0x00F0) >> 4]) {
-                c8->pc += 2;
-            }
-            break;
+void run_batch(const struct Sea8Rom* rom, size_t count, uint64_t cycles, int threads, int lockstep, uint64_t seed)
+{
+    // instance i is seeded with seed + i, so a run is reproducible for a given count
 
-        case 0x0000:
+    uint64_t* seeds = calloc(count, sizeof(*seeds));
+    if (!seeds) {
+        printf("Failed to allocate batch of %zu instances\n", count);
+        exit(1);
+    }
+    for (size_t i = 0; i < count; ++i) {
+        seeds[i] = seed + i;
+    }
 
-            switch (opcode & 0x00FF) {
+    struct Sea8Batch batch;
+    int error = sea8_batch_init(&batch, rom, count, threads, seeds, NULL, NULL);
+    if (error != SEA8_OK) {
+        printf("%s: batch of %zu instances\n", sea8_error_string(error), count);
+        exit(1);
+    }
+    batch.lockstep = lockstep;
+
+    double start_time = get_time_seconds();
+    sea8_batch_step(&batch, cycles);
+    double elapsed = get_time_seconds() - start_time;
+
+    // fold all final states into one checksum so runs can be compared
+    uint64_t checksum = SEA8_FNV_OFFSET;
+    size_t halted = 0;
+    for (size_t i = 0; i < count; ++i) {
+        struct Sea8BatchResult result;
+        sea8_batch_collect(&batch, i, &result);
+        checksum = sea8_fnv1a(checksum, result.gfx, sizeof(result.gfx));
+        checksum = sea8_fnv1a(checksum, result.V, sizeof(result.V));
+        halted += result.error != SEA8_OK;
+    }
 
-            case 0x00E0:
+    double total = (double)cycles * count;
+    printf("engine:       %s\n", sea8_engine_name);
+    printf("instances:    %zu on %zu threads\n", count, batch.worker_count);
+    printf("seed:         %llu\n", (unsigned long long)seed);
+    printf("instructions: %.0f (%llu per instance)\n", total, (unsigned long long)cycles);
+    printf("wall time:    %.6f s\n", elapsed);
+    printf("instr/sec:    %.0f (%.2f MIPS)\n", total / elapsed, total / elapsed / 1e6);
+    printf("checksum:     %016llx\n", (unsigned long long)checksum);
+    if (halted > 0) {
+        printf("halted:       %zu instances\n", halted);
+    }
+    if (lockstep) {
+        uint64_t converged = atomic_load(&batch.converged_steps);
+        uint64_t scalar = atomic_load(&batch.scalar_steps);
+        printf("lockstep:     %d lanes, %.1f%% of steps converged\n", SEA8_LANE_COUNT,
+            converged + scalar ? 100.0 * converged / (converged + scalar) : 0.0);
+    }
 
-                // opcode 0x00E0, clear the display
-                memset(c8->gfx, 0, sizeof(c8->gfx));
-                break;
+    sea8_batch_free(&batch);
+    free(seeds);
+}
 
-            case 0x00EE:
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// trace mode
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-                // opcode 0x00EE, return from subroutine
-                c8->pc = stack_pop(&c8->stack);
-                break;
+// --trace prints the machine state after every frame in a format that
+// rusty8 and pyslow8 print as well, so tools/difftest.py can compare the
+// three line by line. A frame is: apply the key script, tick the timers,
+// run SEA8_INSTR_PER_FRAME instructions. Each line is
+//
+//   frame pc I V0..VF delay_timer gfx
+//
+// in hex, V as 32 digits and gfx as the FNV-1a hash of all pixels of the
+// current resolution, one byte (0 or 1) per pixel in row order.
+
+struct Sea8KeyEvent* load_key_script(const char* path, size_t* len)
+{
+    // one "FRAME KEYS" pair per line, KEYS a hex mask held from that frame
+    // on, # starts a comment. Returns NULL (reason printed) on failure.
 
-            default:
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("Failed to open key script: %s\n", path);
+        return NULL;
+    }
 
-                printf("Unknown opcode: 0x%04X\n", opcode);
+    size_t capacity = 64;
+    struct Sea8KeyEvent* script = malloc(capacity * sizeof(*script));
+    *len = 0;
+    char line[256];
+    int line_no = 0;
+
+    while (script && fgets(line, sizeof(line), file)) {
+        line_no++;
+        char* comment = strchr(line, '#');
+        if (comment) {
+            *comment = 0;
+        }
+        unsigned long long frame;
+        unsigned int keys;
+        int fields = sscanf(line, "%llu %x", &frame, &keys);
+        if (fields <= 0) {
+            continue; // blank
+        }
+        if (fields != 2 || keys > 0xFFFF || (*len > 0 && frame * SEA8_INSTR_PER_FRAME < script[*len - 1].cycle)) {
+            printf("Bad key script line %d: %s\n", line_no, path);
+            free(script);
+            script = NULL;
+            break;
+        }
+        if (*len == capacity) {
+            capacity *= 2;
+            struct Sea8KeyEvent* grown = realloc(script, capacity * sizeof(*script));
+            if (!grown) {
+                free(script);
+                script = NULL;
                 break;
             }
+            script = grown;
+        }
+        script[(*len)++] = (struct Sea8KeyEvent) { frame * SEA8_INSTR_PER_FRAME, (uint16_t)keys };
+    }
 
-            break;
-
-        case 0xA000:
+    fclose(file);
+    return script;
+}
 
-            // opcode 0xANNN, set index register I to NNN
-            c8->I = opcode & 0x0FFF;
-            break;
+int run_trace(struct Sea8Machine* c8, uint64_t frames, const struct Sea8KeyEvent* script, size_t script_len)
+{
+    // returns the error the machine halted on, the trace ends there
 
-        case 0xB000:
+    size_t script_pos = 0;
+    uint16_t keys = 0;
+    uint32_t unknown_reported = 0;
 
-            // opcode 0xBNNN, jump to address NNN + V0
-            c8->pc = (opcode & 0x0FFF) + c8->V[0];
+    for (uint64_t f = 0; f < frames; ++f) {
+        while (script_pos < script_len && script[script_pos].cycle <= f * SEA8_INSTR_PER_FRAME) {
+            keys = script[script_pos++].keys;
+        }
+        sea8_set_keys(c8, keys);
+        sea8_update_timers(c8);
+        int error = sea8_emulate_instructions(c8, SEA8_INSTR_PER_FRAME);
+        report_unknown_opcodes(c8, &unknown_reported);
+        if (error != SEA8_OK) {
+            printf("halted: %s at 0x%03zX\n", sea8_error_string(c8->error), c8->pc);
             break;
+        }
 
-        case 0xC000:
+        uint8_t pixels[SEA8_HIRES_HEIGHT * SEA8_HIRES_WIDTH];
+        int width = SEA8_GFX_WIDTH(c8->hires);
+        int height = SEA8_GFX_HEIGHT(c8->hires);
+        for (int y = 0; y < height; ++y) {
+            for (int x = 0; x < width; ++x) {
+                pixels[y * width + x] = sea8_gfx_pixel(c8->gfx, x, y);
+            }
+        }
 
-            // opcode 0xCXNN, set VX to random byte AND NN
-            c8->V[(opcode & 0x0F00) >> 8] = (rand() % 256) & (opcode & 0x00FF);
-            break;
+        printf("%llu %03zx %03x ", (unsigned long long)f, c8->pc, c8->I);
+        for (int r = 0; r < SEA8_REGISTER_COUNT; ++r) {
+            printf("%02x", c8->V[r]);
+        }
+        printf(" %02x %016llx\n", c8->delay_timer, (unsigned long long)sea8_fnv1a(SEA8_FNV_OFFSET, pixels, (size_t)width * height));
+    }
 
-        case 0xE000:
+    return c8->error;
+}
 
-            switch (opcode & 0x00FF) {
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// replay
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-            case 0x009E:
+struct Replay {
+    uint64_t seed;
+    uint64_t ips;
+    int quirks;
+    struct Sea8KeyEvent* events;
+    size_t len;
+    int has_end; // the log was closed, end_* are valid
+    uint64_t end_instructions;
+    uint64_t end_hash;
+};
 
-                // opcode 0xEX9E, skip next instruction if key with value VX is pressed
-                if (c8->keys[c8->V[(opcode & 0x0F00) >> 8]]) {
-                    c8->pc += 2;
-                }
-                break;
+int load_replay(const char* path, struct Replay* replay)
+{
+    // reads a --record log, returns 0 (reason printed) on failure
 
-            case 0x00A1:
+    FILE* file = fopen(path, "r");
+    if (!file) {
+        printf("Failed to open key log: %s\n", path);
+        return 0;
+    }
 
-                // opcode 0xEXA1, skip next instruction if key with value VX is not pressed
-                if (!c8->keys[c8->V[(opcode & 0x0F00) >> 8]]) {
-                    c8->pc += 2;
+    memset(replay, 0, sizeof(*replay));
+    size_t capacity = 256;
+    replay->events = malloc(capacity * sizeof(*replay->events));
+    char line[256];
+    int line_no = 0;
+    int ok = replay->events && fgets(line, sizeof(line), file)
+        && strncmp(line, KEY_LOG_MAGIC, strlen(KEY_LOG_MAGIC)) == 0;
+    int have_seed = 0;
+    int have_ips = 0;
+    line_no++;
+
+    while (ok && !replay->has_end && fgets(line, sizeof(line), file)) {
+        line_no++;
+        unsigned long long a, b;
+        unsigned int keys;
+        char name[16];
+        if (sscanf(line, "seed %llu", &a) == 1) {
+            replay->seed = a;
+            have_seed = 1;
+        } else if (sscanf(line, "ips %llu", &a) == 1) {
+            replay->ips = a;
+            have_ips = a > 0;
+            ok = have_ips;
+        } else if (sscanf(line, "quirks %15s", name) == 1) {
+            replay->quirks = sea8_quirks_from_name(name);
+            ok = replay->quirks >= 0;
+        } else if (sscanf(line, "end %llu %llx", &a, &b) == 2) {
+            replay->has_end = 1;
+            replay->end_instructions = a;
+            replay->end_hash = b;
+        } else if (sscanf(line, "%llu %x", &a, &keys) == 2 && keys <= 0xFFFF
+            && (replay->len == 0 || a >= replay->events[replay->len - 1].cycle)) {
+            if (replay->len == capacity) {
+                capacity *= 2;
+                struct Sea8KeyEvent* grown = realloc(replay->events, capacity * sizeof(*grown));
+                if (!grown) {
+                    ok = 0;
+                    break;
                 }
-                break;
-
-            default:
-                printf("Unknown opcode: 0x%04X\n", opcode);
-                break;
+                replay->events = grown;
             }
+            replay->events[replay->len++] = (struct Sea8KeyEvent) { a, (uint16_t)keys };
+        } else {
+            ok = 0;
+        }
+    }
+    fclose(file);
 
-            break;
+    if (!ok || !have_seed || !have_ips) {
+        printf("Bad key log line %d: %s\n", line_no, path);
+        free(replay->events);
+        return 0;
+    }
+    return 1;
+}
 
-        case 0xF000:
+int run_replay(struct Sea8Machine* c8, const struct Replay* replay)
+{
+    // runs the recorded session flat out through the same scheduler steps
+    // as the window (timer tick k at instruction k * ips / 60, keys set
+    // between slices), so it ends in the recorded state. Returns nonzero if
+    // it does not.
+
+    struct Scheduler sched;
+    scheduler_init(&sched, replay->ips, 0);
+    uint64_t end = replay->has_end ? replay->end_instructions
+        : replay->len ? replay->events[replay->len - 1].cycle : 0;
+
+    double start_time = get_time_seconds();
+    uint64_t start_cycles = sea8_read_cycle_counter();
+
+    for (size_t e = 0; e < replay->len && replay->events[e].cycle <= end; ++e) {
+        scheduler_run_to(&sched, c8, replay->events[e].cycle);
+        sea8_set_keys(c8, replay->events[e].keys);
+    }
+    scheduler_run_to(&sched, c8, end);
 
-            switch (opcode & 0x00FF) {
+    print_run_report(c8, sched.instructions, get_time_seconds() - start_time, sea8_read_cycle_counter() - start_cycles,
+        replay->seed);
+    printf("key events:   %zu at %llu ips\n", replay->len, (unsigned long long)replay->ips);
 
-            case 0x0007:
+    if (!replay->has_end) {
+        printf("recorded:     no end record, nothing to compare\n");
+        return 0;
+    }
+    int match = sea8_state_hash(c8) == replay->end_hash;
+    printf("recorded:     %016llx (%s)\n", (unsigned long long)replay->end_hash, match ? "match" : "MISMATCH");
+    return !match;
+}
 
-                // opcode 0xFX07, set VX to value of delay timer
-                c8->V[(opcode & 0x0F00) >> 8] = c8->delay_timer;
-                break;
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// static analysis
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-            case 0x000A:
-
-                // opcode 0xFX0A, wait for a key release, store the value in VX
-                {
-                    int key_released = 0;
-                    for (int k = 0; k < KEY_COUNT; ++k) {
-                        if (c8->prev_keys[k] && !c8->keys[k]) {
-                            c8->V[(opcode & 0x0F00) >> 8] = k;
-                            key_released = 1;
-                            break;
-                        }
-                    }
-                    if (!key_released) {
-                        c8->pc -= 2; // repeat this instruction
-                    }
-                }
-                break;
+int run_analysis(const struct Sea8Rom* rom)
+{
+    // --analyze prints the control flow listing of the program (see
+    // sea8_analyze) instead of running it
+    static struct Sea8RomAnalysis analysis;
+    int error = sea8_analyze(&rom->image, &analysis);
+    if (error != SEA8_OK) {
+        printf("%s\n", sea8_error_string(error));
+        return 1;
+    }
+    size_t end = SEA8_PROGRAM_START + rom->size;
+    sea8_analysis_print(stdout, &rom->image, &analysis, end < SEA8_MEM_SIZE ? end : SEA8_MEM_SIZE);
+    return 0;
+}
 
-            case 0x0015:
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// streaming server
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-                // opcode 0xFX15, set delay timer to VX
-                c8->delay_timer = c8->V[(opcode & 0x0F00) >> 8];
-                break;
+// --serve PORT runs one machine per TCP connection, all on one thread: a
+// poll loop over the listening socket and every session, with non-blocking
+// sockets throughout, so a slow or stalled client never holds up the
+// others. Every machine starts as a clone of the one loaded ROM and shares
+// its pages until it writes to them. They all tick at 60 Hz like the window
+// loop (keys, timers, then ips / 60 instructions).
+//
+// The client sends two byte messages, 'd' or 'u' and a key 0-F, for a key
+// going down or up. The server sends
+//   'F' flags len_lo len_hi <len bytes>  a frame
+//   'H' error                            the machine halted (enum Sea8Error)
+// flags bit 0 is hires, bit 1 two planes (XO-CHIP). A frame is packed with
+// one bit per pixel, MSB first, row by row for each plane in turn, 256
+// bytes for 64x32. What is sent is that packed frame XORed with the
+// previous one, run length encoded as (count 1-255, byte) pairs. The first
+// frame and a frame whose flags differ from the previous one are XORed
+// with all zeros. A frame is only sent when the machine's dirty rows (set
+// by DXYN, 00E0 and the scrolls) changed a pixel, and never while the
+// previous one is still queued: the next delta then covers both.
+
+#ifdef SEA8_HEADLESS
+#define PACKED_FRAME_MAX (SEA8_PLANE_COUNT * SEA8_HIRES_WIDTH * SEA8_HIRES_HEIGHT / 8)
+#define SERVE_OUT_SIZE (4 + 2 * PACKED_FRAME_MAX + 2) // a frame with no runs at all, and a halt
+#define SESSION_EDGE_MAX 16 // key edges waiting for a frame
+
+#ifdef _WIN32
+typedef SOCKET socket_t;
+#define poll WSAPoll
+#define close_socket closesocket
+#define SOCKET_WOULD_BLOCK() (WSAGetLastError() == WSAEWOULDBLOCK)
+#define SEND_FLAGS 0
+#else
+typedef int socket_t;
+#define INVALID_SOCKET (-1)
+#define close_socket close
+#define SOCKET_WOULD_BLOCK() (errno == EAGAIN || errno == EWOULDBLOCK)
+#define SEND_FLAGS MSG_NOSIGNAL // a closed client is an error from send, not SIGPIPE
+#endif
+
+struct Session {
+    socket_t sock;
+    struct Sea8Machine c8;
+    uint16_t keys; // as of the last edge applied
+    uint16_t edges[SESSION_EDGE_MAX]; // the key mask after each waiting edge, oldest first
+    size_t edge_count;
+    int closed;
+    int halt_sent;
+    uint8_t sent[PACKED_FRAME_MAX]; // the last frame queued, the base of the next delta
+    int sent_flags; // -1 until the first frame
+    uint8_t in[2]; // a partly received message
+    size_t in_len;
+    uint8_t out[SERVE_OUT_SIZE];
+    size_t out_len;
+    size_t out_pos;
+};
 
-            case 0x0018:
+int socket_set_nonblocking(socket_t sock)
+{
+#ifdef _WIN32
+    u_long on = 1;
+    return ioctlsocket(sock, FIONBIO, &on) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags >= 0 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
 
-                // opcode 0xFX18, set sound timer to VX
-                c8->sound_timer = c8->V[(opcode & 0x0F00) >> 8];
-                break;
+size_t frame_pack(const struct Sea8Machine* c8, uint8_t* out, int* flags)
+{
+    // returns the packed size, see the protocol above
+    int planes = c8->quirks == SEA8_QUIRKS_XOCHIP ? SEA8_PLANE_COUNT : 1;
+    int words = SEA8_GFX_WIDTH(c8->hires) / 64;
+    size_t size = 0;
+
+    for (int p = 0; p < planes; ++p) {
+        for (int y = 0; y < SEA8_GFX_HEIGHT(c8->hires); ++y) {
+            for (int w = 0; w < words; ++w) {
+                uint64_t word = c8->gfx[SEA8_GFX_INDEX(y, p) + w];
+                for (int b = 0; b < 8; ++b) {
+                    out[size++] = (uint8_t)(word >> (56 - 8 * b));
+                }
+            }
+        }
+    }
+    *flags = (c8->hires ? 1 : 0) | (planes > 1 ? 2 : 0);
+    return size;
+}
 
-            case 0x001E:
+size_t rle_encode(const uint8_t* data, size_t len, uint8_t* out)
+{
+    // (count, byte) pairs, out needs room for 2 * len bytes
+    size_t size = 0;
+    for (size_t i = 0; i < len;) {
+        size_t run = 1;
+        while (i + run < len && run < 255 && data[i + run] == data[i]) {
+            ++run;
+        }
+        out[size++] = (uint8_t)run;
+        out[size++] = data[i];
+        i += run;
+    }
+    return size;
+}
 
-                // opcode 0xFX1E, add VX to I
-                c8->I += c8->V[(opcode & 0x0F00) >> 8];
-                break;
+void session_queue_frame(struct Session* s)
+{
+    if (s->out_len > 0 || s->c8.dirty_rows == 0) {
+        return;
+    }
+    s->c8.dirty_rows = 0;
 
-            case 0x0029:
+    uint8_t frame[PACKED_FRAME_MAX];
+    int flags;
+    size_t size = frame_pack(&s->c8, frame, &flags);
+    if (flags != s->sent_flags) {
+        memset(s->sent, 0, sizeof(s->sent));
+    }
 
-                // opcode 0xFX29, set I to location of sprite for digit VX
-                c8->I = FONTSET_START + (c8->V[(opcode & 0x0F00) >> 8] * 5);
-                break;
+    // XOR in place, the packed frame becomes the new base
+    uint8_t changed = 0;
+    for (size_t i = 0; i < size; ++i) {
+        uint8_t pixels = frame[i];
+        frame[i] ^= s->sent[i];
+        s->sent[i] = pixels;
+        changed |= frame[i];
+    }
+    if (!changed && flags == s->sent_flags) {
+        return; // rows were drawn twice, or erased and redrawn
+    }
+    s->sent_flags = flags;
+
+    size_t len = rle_encode(frame, size, s->out + 4);
+    s->out[0] = 'F';
+    s->out[1] = (uint8_t)flags;
+    s->out[2] = (uint8_t)len;
+    s->out[3] = (uint8_t)(len >> 8);
+    s->out_len = 4 + len;
+}
 
-            case 0x0033:
+void session_flush(struct Session* s)
+{
+    while (s->out_pos < s->out_len) {
+        int sent = (int)send(s->sock, (const char*)s->out + s->out_pos, (int)(s->out_len - s->out_pos), SEND_FLAGS);
+        if (sent <= 0) {
+            s->closed |= !SOCKET_WOULD_BLOCK();
+            return;
+        }
+        s->out_pos += (size_t)sent;
+    }
+    s->out_len = 0;
+    s->out_pos = 0;
+}
 
-                // opcode 0xFX33, store digits of VX in memory at addresses I, I+1, I+2
-                {
-                    uint8_t val = c8->V[(opcode & 0x0F00) >> 8];
-                    c8->mem[c8->I] = val / 100;
-                    c8->mem[c8->I + 1] = (val / 10) % 10;
-                    c8->mem[c8->I + 2] = val % 10;
-                }
-                break;
+void session_receive(struct Session* s)
+{
+    // drain what arrived, a bad message or an orderly close ends the session
+    char buf[256];
+    for (;;) {
+        int len = (int)recv(s->sock, buf, sizeof(buf), 0);
+        if (len <= 0) {
+            s->closed |= len == 0 || !SOCKET_WOULD_BLOCK();
+            return;
+        }
+        for (int i = 0; i < len; ++i) {
+            s->in[s->in_len++] = (uint8_t)buf[i];
+            if (s->in_len < 2) {
+                continue;
+            }
+            s->in_len = 0;
+            if (s->in[1] >= SEA8_KEY_COUNT || (s->in[0] != 'd' && s->in[0] != 'u')) {
+                s->closed = 1;
+                return;
+            }
+            // each edge gets a frame of its own (see session_step), a full
+            // queue folds the edge into the last one
+            uint16_t last = s->edge_count ? s->edges[s->edge_count - 1] : s->keys;
+            uint16_t bit = (uint16_t)(1u << s->in[1]);
+            uint16_t keys = s->in[0] == 'd' ? last | bit : last & (uint16_t)~bit;
+            if (keys == last) {
+                continue;
+            }
+            if (s->edge_count == SESSION_EDGE_MAX) {
+                s->edges[s->edge_count - 1] = keys;
+            } else {
+                s->edges[s->edge_count++] = keys;
+            }
+        }
+    }
+}
 
-            case 0x0055:
+void session_step(struct Session* s, uint64_t instructions)
+{
+    // one 60 Hz frame, with at most one new key edge so a press and release
+    // that arrived together are both seen (like a replay, which sets keys
+    // between slices)
+    if (s->edge_count > 0) {
+        s->keys = s->edges[0];
+        memmove(s->edges, s->edges + 1, --s->edge_count * sizeof(s->edges[0]));
+    }
+    sea8_set_keys(&s->c8, s->keys);
+    sea8_update_timers(&s->c8);
+    sea8_emulate_instructions(&s->c8, (int)instructions);
+}
 
-                // opcode 0xFX55, store registers V0 to VX in memory starting at address I
-                {
-                    size_t x = (opcode & 0x0F00) >> 8;
-                    memcpy(&c8->mem[c8->I], c8->V, x + 1);
-                    c8->I += x + 1;
-                }
-                break;
+void session_send(struct Session* s)
+{
+    // after the ticks of one loop iteration, the frame they drew (if any)
+    // and then the halt, is sent as far as the socket takes it
+    session_queue_frame(s);
+    if (s->c8.error != SEA8_OK && !s->halt_sent && s->out_len + 2 <= sizeof(s->out)) {
+        s->out[s->out_len++] = 'H';
+        s->out[s->out_len++] = s->c8.error;
+        s->halt_sent = 1;
+    }
+    session_flush(s);
+}
 
-            case 0x0065:
+socket_t server_listen(int port)
+{
+    socket_t sock = socket(AF_INET, SOCK_STREAM, 0);
+    if (sock == INVALID_SOCKET) {
+        return INVALID_SOCKET;
+    }
+    int on = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, (const char*)&on, sizeof(on));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    addr.sin_port = htons((uint16_t)port);
+    if (bind(sock, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(sock, SERVE_BACKLOG) != 0
+        || !socket_set_nonblocking(sock)) {
+        close_socket(sock);
+        return INVALID_SOCKET;
+    }
+    return sock;
+}
 
-                // opcode 0xFX65, read registers V0 to VX from memory starting at address I
-                {
-                    size_t x = (opcode & 0x0F00) >> 8;
-                    memcpy(c8->V, &c8->mem[c8->I], x + 1);
-                    c8->I += x + 1;
-                }
-                break;
+void server_accept(socket_t listener, const struct Sea8Rom* rom, struct Session** sessions, size_t* count,
+    uint64_t* next_seed)
+{
+    for (;;) {
+        socket_t sock = accept(listener, NULL, NULL);
+        if (sock == INVALID_SOCKET) {
+            return;
+        }
+        struct Session* s = *count < SERVE_MAX_SESSIONS ? malloc(sizeof(*s)) : NULL;
+        if (!s || !socket_set_nonblocking(sock)) {
+            free(s);
+            close_socket(sock);
+            continue;
+        }
+        int on = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&on, sizeof(on));
+
+        memset(s, 0, sizeof(*s));
+        s->sock = sock;
+        s->sent_flags = -1;
+        sea8_init_rom(&s->c8, rom, (*next_seed)++);
+        sessions[(*count)++] = s;
+    }
+}
 
-            default:
-                printf("Unknown opcode: 0x%04X\n", opcode);
-                break;
+int run_server(const struct Sea8Rom* rom, int port, uint64_t ips, uint64_t seed)
+{
+    // runs until killed, returns 1 if the port could not be opened
+#ifdef _WIN32
+    WSADATA wsa;
+    if (WSAStartup(MAKEWORD(2, 2), &wsa) != 0) {
+        printf("Failed to start Winsock\n");
+        return 1;
+    }
+#endif
+    socket_t listener = server_listen(port);
+    if (listener == INVALID_SOCKET) {
+        printf("Failed to listen on port %d\n", port);
+        return 1;
+    }
+    printf("serving on port %d, %llu instructions per second\n", port, (unsigned long long)ips);
+    fflush(stdout);
+
+    static struct Session* sessions[SERVE_MAX_SESSIONS];
+    static struct pollfd fds[1 + SERVE_MAX_SESSIONS];
+    size_t count = 0;
+    uint64_t next_seed = seed;
+    uint64_t tick = 0;
+    double start = get_time_seconds();
+
+    for (;;) {
+        // sleep until the next tick, or until something arrives or a
+        // stalled client can take more
+        double now = get_time_seconds();
+        double next_tick = start + (double)(tick + 1) / TIMER_HZ;
+        int timeout = next_tick > now ? (int)((next_tick - now) * 1000) + 1 : 0;
+
+        fds[0].fd = listener;
+        fds[0].events = POLLIN;
+        for (size_t i = 0; i < count; ++i) {
+            fds[1 + i].fd = sessions[i]->sock;
+            fds[1 + i].events = (short)(POLLIN | (sessions[i]->out_len > 0 ? POLLOUT : 0));
+            fds[1 + i].revents = 0;
+        }
+        poll(fds, (unsigned)(1 + count), timeout);
+
+        for (size_t i = 0; i < count; ++i) {
+            if (fds[1 + i].revents & (POLLIN | POLLHUP | POLLERR)) {
+                session_receive(sessions[i]);
+            }
+            if (fds[1 + i].revents & POLLOUT) {
+                session_flush(sessions[i]);
             }
+        }
+        if (fds[0].revents & POLLIN) {
+            server_accept(listener, rom, sessions, &count, &next_seed);
+        }
 
-            break;
+        // every tick that is due, at most CATCHUP_MAX_SECONDS of them after
+        // a stall; tick k runs the instructions up to (k + 1) * ips / 60
+        now = get_time_seconds();
+        uint64_t due = (uint64_t)((now - start) * TIMER_HZ);
+        if (due > tick + (uint64_t)(CATCHUP_MAX_SECONDS * TIMER_HZ)) {
+            tick = due - (uint64_t)(CATCHUP_MAX_SECONDS * TIMER_HZ);
+        }
+        int ticked = tick < due;
+        for (; tick < due; ++tick) {
+            uint64_t instructions = (tick + 1) * ips / TIMER_HZ - tick * ips / TIMER_HZ;
+            for (size_t i = 0; i < count; ++i) {
+                session_step(sessions[i], instructions);
+            }
+        }
 
-        default:
-            printf("Unknown opcode: 0x%04X\n", opcode);
-            break;
+        for (size_t i = 0; i < count;) {
+            struct Session* s = sessions[i];
+            if (ticked && !s->closed) {
+                session_send(s);
+            }
+            if (s->closed) {
+                close_socket(s->sock);
+                sea8_free(&s->c8);
+                free(s);
+                sessions[i] = sessions[--count];
+            } else {
+                ++i;
+            }
         }
     }
 }
+#endif
 
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// miscellaneous functions
+// main interpreter loop
 // ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
 
-void draw_frame_to_window(uint8_t* gfx)
+int main(int argc, char** argv)
 {
-    BeginDrawing();
-    ClearBackground(BLACK);
+    const char* rom_path = NULL;
+    const char** batch_paths = calloc(argc, sizeof(*batch_paths));
+    size_t batch_rom_count = 0;
+    int bad_args = !batch_paths;
+    uint64_t cycles = DEFAULT_BENCH_CYCLES;
+    size_t batch_count = 0;
+    int threads = 0;
+    int lockstep = 0;
+    int analyze = 0;
+    int serve_port = 0;
+    uint64_t ips = DEFAULT_IPS;
+    double turbo_speed = DEFAULT_TURBO_SPEED;
+    const char* stats_path = NULL;
+    int audio_buffer = DEFAULT_AUDIO_BUFFER;
+    uint64_t trace_frames = 0;
+    const char* keys_path = NULL;
+    const char* record_path = NULL;
+    const char* replay_path = NULL;
+    int quirks = SEA8_QUIRKS_CHIP8;
+    int turbo = 0;
+    int seed_given = 0;
+    uint64_t seed = 0;
+#ifdef SEA8_HEADLESS
+    int headless = 1;
+#else
+    int headless = 0;
+#endif
+
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--headless") == 0) {
+            headless = 1;
+        } else if (strcmp(argv[i], "--cycles") == 0 && i + 1 < argc) {
+            cycles = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            batch_count = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--threads") == 0 && i + 1 < argc) {
+            threads = atoi(argv[++i]);
+        } else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+            seed = strtoull(argv[++i], NULL, 10);
+            seed_given = 1;
+        } else if (strcmp(argv[i], "--lockstep") == 0) {
+            lockstep = 1;
+        } else if (strcmp(argv[i], "--analyze") == 0) {
+            analyze = 1;
+        } else if (strcmp(argv[i], "--serve") == 0 && i + 1 < argc) {
+            serve_port = atoi(argv[++i]);
+            bad_args |= serve_port <= 0 || serve_port > 65535;
+        } else if (strcmp(argv[i], "--ips") == 0 && i + 1 < argc) {
+            ips = strtoull(argv[++i], NULL, 10);
+            ips = ips < MAX_IPS ? ips : MAX_IPS;
+        } else if (strcmp(argv[i], "--turbo") == 0 && i + 1 < argc) {
+            turbo_speed = strtod(argv[++i], NULL);
+            turbo_speed = turbo_speed >= 1 || turbo_speed == 0 ? turbo_speed : 1;
+            turbo = 1;
+        } else if (strcmp(argv[i], "--audio-buffer") == 0 && i + 1 < argc) {
+            audio_buffer = atoi(argv[++i]);
+            bad_args |= audio_buffer < 0;
+        } else if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc) {
+            stats_path = argv[++i];
+        } else if (strcmp(argv[i], "--trace") == 0 && i + 1 < argc) {
+            trace_frames = strtoull(argv[++i], NULL, 10);
+        } else if (strcmp(argv[i], "--keys") == 0 && i + 1 < argc) {
+            keys_path = argv[++i];
+        } else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+            record_path = argv[++i];
+        } else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+            replay_path = argv[++i];
+        } else if (strcmp(argv[i], "--quirks") == 0 && i + 1 < argc) {
+            quirks = sea8_quirks_from_name(argv[++i]);
+            bad_args |= quirks < 0;
+        } else if (argv[i][0] != '-' && !bad_args) {
+            // only batch runs take more than one ROM
+            rom_path = argv[i];
+            batch_paths[batch_rom_count++] = argv[i];
+        } else {
+            bad_args = 1;
+            break;
+        }
+    }
 
-    for (int y = 0; y < SCREEN_HEIGHT; ++y) {
-        for (int x = 0; x < SCREEN_WIDTH; ++x) {
-            if (gfx[y * SCREEN_WIDTH + x]) {
-                DrawRectangle(x * SCREEN_SCALE, y * SCREEN_SCALE, SCREEN_SCALE, SCREEN_SCALE, BEIGE);
+    if (!rom_path || bad_args || (batch_rom_count > 1 && batch_count == 0)) {
+        printf("Usage: %s [--headless] [--cycles N] [--seed N] [--batch N [--threads N] [--lockstep]] [--ips N] [--turbo N] [--audio-buffer FRAMES] [--stats FILE] [--record FILE] [--quirks PROFILE] <rom_file>\n", argv[0]);
+        printf("       %s --trace FRAMES [--seed N] [--keys FILE] <rom_file>\n", argv[0]);
+        printf("       %s --replay FILE <rom_file>\n", argv[0]);
+        printf("       %s --analyze [--quirks PROFILE] <rom_file>\n", argv[0]);
+        printf("       %s --serve PORT [--ips N] [--seed N] [--quirks PROFILE] <rom_file>   (headless build)\n", argv[0]);
+        printf("       %s --batch N [--threads N] [--lockstep] [--cycles N] [--seed N] <rom_file>...\n", argv[0]);
+        printf("PROFILE is chip8 (default), schip or xochip, any mode takes --quirks\n");
+        printf("FRAMES is the audio buffer size at %d Hz (default %d, 0 = no sound)\n", AUDIO_SAMPLE_RATE, DEFAULT_AUDIO_BUFFER);
+        free(batch_paths);
+        return 1;
+    }
+
+    // headless runs are benchmarks and default to seed 0 so they can be
+    // compared bit for bit, interactive runs get a different game every time
+    if (!seed_given && !headless && batch_count == 0 && trace_frames == 0) {
+        seed = (uint64_t)time(NULL);
+    }
+
+    if (batch_count > 0) {
+        // read and check every ROM up front so a bad file fails before
+        // any batch has run
+        struct Sea8Rom* roms = calloc(batch_rom_count, sizeof(*roms));
+        if (!roms) {
+            printf("Failed to allocate %zu ROMs\n", batch_rom_count);
+            return 1;
+        }
+        for (size_t r = 0; r < batch_rom_count; ++r) {
+            int error = sea8_rom_load(&roms[r], batch_paths[r]);
+            if (error != SEA8_OK) {
+                printf("%s: %s\n", sea8_error_string(error), batch_paths[r]);
+                return 1;
             }
+            error = sea8_set_quirks(&roms[r].image, quirks);
+            if (error != SEA8_OK) {
+                printf("%s: %s (more than 4 KB needs --quirks xochip)\n", sea8_error_string(error), batch_paths[r]);
+                return 1;
+            }
+        }
+        for (size_t r = 0; r < batch_rom_count; ++r) {
+            if (batch_rom_count > 1) {
+                printf("%srom:          %s (%zu bytes)\n", r ? "\n" : "", batch_paths[r], roms[r].size);
+            }
+            run_batch(&roms[r], batch_count, cycles, threads, lockstep, seed);
+            sea8_rom_free(&roms[r]);
         }
+        free(roms);
+        free(batch_paths);
+#ifdef SEA8_PROFILE
+        sea8_profile_report(stdout, NULL);
+#endif
+        return 0;
     }
+    free(batch_paths);
 
-    EndDrawing();
-}
-
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
-// main interpreter loop
-// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+    if (analyze) {
+        struct Sea8Rom rom;
+        int error = sea8_rom_load(&rom, rom_path);
+        if (error == SEA8_OK) {
+            error = sea8_set_quirks(&rom.image, quirks);
+        }
+        if (error != SEA8_OK) {
+            printf("%s: %s\n", sea8_error_string(error), rom_path);
+            return 1;
+        }
+        error = run_analysis(&rom);
+        sea8_rom_free(&rom);
+        return error;
+    }
 
-int main(int argc, char** argv)
-{
-    if (argc != 2) {
-        printf("Usage: %s <rom_file>\n", argv[0]);
+    if (serve_port > 0) {
+#ifdef SEA8_HEADLESS
+        if (ips == 0) {
+            printf("--serve needs a fixed instruction rate, not --ips 0\n");
+            return 1;
+        }
+        struct Sea8Rom rom;
+        int error = sea8_rom_load(&rom, rom_path);
+        if (error == SEA8_OK) {
+            error = sea8_set_quirks(&rom.image, quirks);
+        }
+        if (error != SEA8_OK) {
+            printf("%s: %s\n", sea8_error_string(error), rom_path);
+            return 1;
+        }
+        error = run_server(&rom, serve_port, ips, seed);
+        sea8_rom_free(&rom);
+        return error;
+#else
+        printf("--serve is only in the headless build (make headless)\n");
         return 1;
+#endif
+    }
+
+    struct Replay replay;
+    if (replay_path) {
+        if (!load_replay(replay_path, &replay)) {
+            return 1;
+        }
+        seed = replay.seed;
+        quirks = replay.quirks;
+    }
+
+    struct Sea8Machine c8;
+    chip8_init(&c8, rom_path, seed);
+    int quirks_error = sea8_set_quirks(&c8, quirks);
+    if (quirks_error != SEA8_OK) {
+        printf("%s: %s (more than 4 KB needs --quirks xochip)\n", sea8_error_string(quirks_error), rom_path);
+        exit(1);
+    }
+
+    if (replay_path) {
+        int mismatch = run_replay(&c8, &replay);
+        free(replay.events);
+        sea8_free(&c8);
+        return mismatch;
     }
 
-    struct Chip8 c8;
-    chip8_init(&c8, argv[1]);
+    if (trace_frames > 0) {
+        struct Sea8KeyEvent* script = NULL;
+        size_t script_len = 0;
+        if (keys_path && !(script = load_key_script(keys_path, &script_len))) {
+            return 1;
+        }
+        int error = run_trace(&c8, trace_frames, script, script_len);
+        free(script);
+        sea8_free(&c8);
+        return error != SEA8_OK;
+    }
+
+    if (headless) {
+        int error = run_headless(&c8, cycles, seed);
+#ifdef SEA8_PROFILE
+        sea8_profile_report(stdout, &c8);
+#endif
+        sea8_free(&c8);
+        return error != SEA8_OK;
+    }
 
-    InitWindow(SCREEN_WIDTH * SCREEN_SCALE, SCREEN_HEIGHT * SCREEN_SCALE, "Sea8");
+#ifndef SEA8_HEADLESS
+    // the emulation thread owns c8 from here until emu_thread_stop
+    struct Sea8Machine base;
+    sea8_clone(&base, &c8);
+    static struct EmuThread emu;
+
+    // the log needs timer ticks at fixed instruction counts
+    static struct KeyLog key_log;
+    FILE* record_file = NULL;
+    if (record_path) {
+        if (ips == 0) {
+            printf("--record needs a fixed instruction rate, not --ips 0\n");
+            exit(1);
+        }
+        record_file = fopen(record_path, "w");
+        if (!record_file) {
+            printf("Failed to open key log: %s\n", record_path);
+            exit(1);
+        }
+        fprintf(record_file, "%s\nseed %llu\nips %llu\nquirks %s\n", KEY_LOG_MAGIC, (unsigned long long)seed,
+            (unsigned long long)ips, sea8_quirks_name(quirks));
+        key_log_init(&key_log);
+    }
+
+    InitWindow(SEA8_SCREEN_WIDTH * SCREEN_SCALE, SEA8_SCREEN_HEIGHT * SCREEN_SCALE, "Sea8");
     SetTargetFPS(60);
 
-    double last_status_update = GetTime();
-    char status[128] = { 0 };
+    Image blank = GenImageColor(SEA8_HIRES_WIDTH, SEA8_HIRES_HEIGHT, BLACK);
+    Texture2D screen = LoadTextureFromImage(blank);
+    UnloadImage(blank);
+
+    AudioStream audio_stream;
+    int audio = audio_buffer > 0 && beeper_open(&audio_stream, audio_buffer);
+
+    emu_thread_start(&emu, &c8, &base, ips, turbo_speed, turbo, record_file ? &key_log : NULL, audio ? &window_beeper : NULL);
+
+    FILE* stats_file = NULL;
+    int stats_json = 0;
+    if (stats_path) {
+        size_t len = strlen(stats_path);
+        stats_json = len >= 5 && strcmp(stats_path + len - 5, ".json") == 0;
+        stats_file = fopen(stats_path, "w");
+        if (!stats_file) {
+            printf("Failed to open stats file: %s\n", stats_path);
+            exit(1);
+        }
+        if (!stats_json) {
+            write_stats_header(stats_file);
+        }
+    }
+
+    double start_time = get_time_seconds();
+    double last_status_update = start_time;
+    uint64_t last_status_instructions = 0;
+    char status[256] = { 0 };
 
     while (!WindowShouldClose()) {
-        chip8_handle_input(&c8);
-        chip8_update_timers(&c8);
-        chip8_emulate_instructions(&c8, INSTR_PER_FRAME);
-        draw_frame_to_window(c8.gfx);
+        if (IsKeyPressed(KEY_F5)) {
+            atomic_store(&emu.save_request, 1);
+        }
+        if (IsKeyPressed(KEY_F9)) {
+            atomic_store(&emu.load_request, 1);
+        }
+        if (IsKeyPressed(KEY_TAB)) {
+            atomic_store(&emu.turbo, !atomic_load(&emu.turbo));
+        }
+        emu_thread_set_keys(&emu, poll_key_mask());
+        if (record_file) {
+            key_log_drain(&key_log, record_file);
+        }
 
-        double current_time = GetTime();
-        if (current_time - last_status_update >= 2.0) { // every 2 seconds
+        double render_start = get_time_seconds();
+        int fresh;
+        const struct Frame* frame = triple_buffer_acquire(&emu.frames, &fresh);
+        BeginDrawing();
+        draw_frame_to_window(screen, frame->gfx, frame->hires, fresh ? frame->dirty_rows : 0);
+        double present_start = get_time_seconds();
+        EndDrawing();
+        double current_time = get_time_seconds();
+        phase_stats_add(&emu.stats, PHASE_RENDER, present_start - render_start);
+        phase_stats_add(&emu.stats, PHASE_PRESENT, current_time - present_start);
+
+        if (current_time - last_status_update >= STATS_INTERVAL) {
             float frame_time_ms = GetFrameTime() * 1000;
-            snprintf(status, sizeof(status), "Sea8 | FT: %.4fms | MIPS: %d",
-                frame_time_ms, (int)(INSTR_PER_FRAME * (1000 / frame_time_ms)) / 1000000);
+            uint64_t instructions = atomic_load(&emu.instructions);
+            double ips_now = (instructions - last_status_instructions) / (current_time - last_status_update);
+            double speedup = ips ? ips_now / ips : 1.0;
+
+            struct PhaseSummary phases[PHASE_COUNT];
+            for (int p = 0; p < PHASE_COUNT; ++p) {
+                phases[p] = phase_stats_summary(&emu.stats, p);
+            }
+
+            // min/avg/p99 in milliseconds
+            int error = atomic_load(&emu.error);
+            snprintf(status, sizeof(status),
+                "Sea8 | FT: %.4fms | IPS: %.0f | x%.1f%s | emu %.3f/%.3f/%.3f | render %.3f/%.3f/%.3f | idle %.2f/%.2f/%.2f%s%s",
+                frame_time_ms, ips_now, speedup, atomic_load(&emu.turbo) ? " turbo" : "",
+                phases[PHASE_EMU].min * 1000, phases[PHASE_EMU].avg * 1000, phases[PHASE_EMU].p99 * 1000,
+                phases[PHASE_RENDER].min * 1000, phases[PHASE_RENDER].avg * 1000, phases[PHASE_RENDER].p99 * 1000,
+                phases[PHASE_IDLE].min * 1000, phases[PHASE_IDLE].avg * 1000, phases[PHASE_IDLE].p99 * 1000,
+                error ? " | halted: " : "", error ? sea8_error_string(error) : "");
             SetWindowTitle(status);
+            if (stats_file) {
+                write_stats(stats_file, stats_json, current_time - start_time, instructions, ips_now, speedup, phases);
+            }
             last_status_update = current_time;
+            last_status_instructions = instructions;
         }
     }
 
+    emu_thread_stop(&emu);
+    if (audio) {
+        beeper_close(audio_stream);
+    }
+    if (stats_file) {
+        fclose(stats_file);
+    }
+    if (record_file) {
+        key_log_drain(&key_log, record_file);
+        if (atomic_load(&key_log.overflow)) {
+            printf("Key log overflowed, %s is incomplete\n", record_path);
+        } else {
+            fprintf(record_file, "end %llu %016llx\n", (unsigned long long)key_log.end_instructions,
+                (unsigned long long)key_log.end_hash);
+        }
+        fclose(record_file);
+    }
+    UnloadTexture(screen);
     CloseWindow();
-
+    sea8_free(&base);
+#else
+    (void)turbo; // the window options do nothing without a window
+    (void)stats_path;
+    (void)record_path;
+    (void)audio_buffer;
+#endif
+
+#ifdef SEA8_PROFILE
+    sea8_profile_report(stdout, &c8);
+#endif
+    sea8_free(&c8);
     return 0;
-}
\ No newline at end of file
+}
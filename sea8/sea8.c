@@ -0,0 +1,2735 @@
+#include "sea8.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+#define FONTSET_START 0x50
+#define BIG_FONTSET_START 0xA0 // SCHIP 8x10 digits, right after the 4x5 ones
+#define MEM_PAGE_SIZE (SEA8_MEM_SIZE / SEA8_PAGE_COUNT)
+#define BLOCK_MAX_LEN 32
+
+// how many bytes before a written byte a decode table entry can start and
+// still read it: one for a plain instruction, five for a fused triple
+#define DECODE_REACH 5
+#define LANE_GIVE_UP_FRAMES 60
+#define BATCH_CHUNK (SEA8_LANE_COUNT > 16 ? SEA8_LANE_COUNT : 16)
+#define STATE_MAGIC "S8ST"
+#define STATE_VERSION 3
+
+#if defined(SEA8_THREADED) && defined(SEA8_DYNAREC)
+#error "SEA8_THREADED and SEA8_DYNAREC select different engines, pick one"
+#endif
+
+_Static_assert(SEA8_LANE_COUNT <= 64, "struct Chip8Lanes keeps a 64-bit halted mask");
+
+const char* sea8_error_string(int error)
+{
+    switch (error) {
+    case SEA8_OK: return "No error";
+    case SEA8_ERR_OPEN: return "Failed to open ROM file";
+    case SEA8_ERR_READ: return "Failed to read ROM file";
+    case SEA8_ERR_ROM_TOO_LARGE: return "ROM file is too large to fit in mem";
+    case SEA8_ERR_NO_MEMORY: return "Out of memory";
+    case SEA8_ERR_BAD_STATE: return "Not a valid save state";
+    case SEA8_ERR_STACK_OVERFLOW: return "Stack overflow";
+    case SEA8_ERR_STACK_UNDERFLOW: return "Stack underflow";
+    case SEA8_ERR_THREAD: return "Failed to start a worker thread";
+    default: return "Unknown error";
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// stack data structure
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+static void stack_init(struct Sea8Stack* stack)
+{
+    stack->ptr = 0;
+    memset(stack->data, 0, sizeof(stack->data));
+}
+
+static int stack_push(struct Sea8Stack* stack, size_t value)
+{
+    if (stack->ptr >= SEA8_STACK_SIZE) {
+        return SEA8_ERR_STACK_OVERFLOW;
+    }
+    stack->data[stack->ptr++] = value;
+    return SEA8_OK;
+}
+
+static int stack_pop(struct Sea8Stack* stack, size_t* value)
+{
+    if (stack->ptr == 0) {
+        return SEA8_ERR_STACK_UNDERFLOW;
+    }
+    *value = stack->data[--stack->ptr];
+    return SEA8_OK;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// instruction decoding
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+enum Op {
+    OP_UNKNOWN,
+    OP_00E0,
+    OP_00EE,
+    OP_00CN,
+    OP_00DN,
+    OP_00FB,
+    OP_00FC,
+    OP_00FD,
+    OP_00FE,
+    OP_00FF,
+    OP_1NNN,
+    OP_2NNN,
+    OP_3XNN,
+    OP_4XNN,
+    OP_5XY0,
+    OP_5XY2,
+    OP_5XY3,
+    OP_6XNN,
+    OP_7XNN,
+    OP_8XY0,
+    OP_8XY1,
+    OP_8XY2,
+    OP_8XY3,
+    OP_8XY4,
+    OP_8XY5,
+    OP_8XY6,
+    OP_8XY7,
+    OP_8XYE,
+    OP_9XY0,
+    OP_ANNN,
+    OP_BNNN,
+    OP_CXNN,
+    OP_DXYN,
+    OP_EX9E,
+    OP_EXA1,
+    OP_F000,
+    OP_FN01,
+    OP_F002,
+    OP_FX07,
+    OP_FX0A,
+    OP_FX15,
+    OP_FX18,
+    OP_FX1E,
+    OP_FX29,
+    OP_FX30,
+    OP_FX33,
+    OP_FX3A,
+    OP_FX55,
+    OP_FX65,
+    // superinstructions, built by fuse_instr, see there for the operands
+    OP_ANNN_DXYN,
+    OP_6XNN_6YNN,
+    OP_3XNN_1NNN,
+    OP_4XNN_1NNN,
+    OP_7XNN_3XNN_1NNN,
+    OP_7XNN_4XNN_1NNN,
+    OP_COUNT
+};
+
+#define OP_FUSED_FIRST OP_ANNN_DXYN
+
+// an opcode with its handler index and operands already extracted
+struct Instr {
+    uint8_t op;
+    uint8_t x;
+    uint8_t y;
+    uint8_t n;
+    uint8_t nn;
+#ifdef SEA8_DYNAREC
+    uint8_t block_len; // instructions in the block starting here, fills the padding before nnn
+#endif
+    uint16_t nnn;
+};
+
+static uint8_t decode_op(uint16_t opcode)
+{
+    switch (opcode & 0xF000) {
+    case 0x0000:
+        switch (opcode & 0x00FF) {
+        case 0x00E0: return OP_00E0;
+        case 0x00EE: return OP_00EE;
+        case 0x00FB: return OP_00FB;
+        case 0x00FC: return OP_00FC;
+        case 0x00FD: return OP_00FD;
+        case 0x00FE: return OP_00FE;
+        case 0x00FF: return OP_00FF;
+        default:
+            switch (opcode & 0x00F0) {
+            case 0x00C0: return OP_00CN;
+            case 0x00D0: return OP_00DN;
+            default: return OP_UNKNOWN;
+            }
+        }
+    case 0x1000: return OP_1NNN;
+    case 0x2000: return OP_2NNN;
+    case 0x3000: return OP_3XNN;
+    case 0x4000: return OP_4XNN;
+    case 0x5000:
+        switch (opcode & 0x000F) {
+        case 0x0002: return OP_5XY2;
+        case 0x0003: return OP_5XY3;
+        default: return OP_5XY0;
+        }
+    case 0x6000: return OP_6XNN;
+    case 0x7000: return OP_7XNN;
+    case 0x8000:
+        switch (opcode & 0x000F) {
+        case 0x0000: return OP_8XY0;
+        case 0x0001: return OP_8XY1;
+        case 0x0002: return OP_8XY2;
+        case 0x0003: return OP_8XY3;
+        case 0x0004: return OP_8XY4;
+        case 0x0005: return OP_8XY5;
+        case 0x0006: return OP_8XY6;
+        case 0x0007: return OP_8XY7;
+        case 0x000E: return OP_8XYE;
+        default: return OP_UNKNOWN;
+        }
+    case 0x9000: return OP_9XY0;
+    case 0xA000: return OP_ANNN;
+    case 0xB000: return OP_BNNN;
+    case 0xC000: return OP_CXNN;
+    case 0xD000: return OP_DXYN;
+    case 0xE000:
+        switch (opcode & 0x00FF) {
+        case 0x009E: return OP_EX9E;
+        case 0x00A1: return OP_EXA1;
+        default: return OP_UNKNOWN;
+        }
+    default: // 0xF000
+        switch (opcode & 0x00FF) {
+        case 0x0000: return opcode == 0xF000 ? OP_F000 : OP_UNKNOWN;
+        case 0x0001: return OP_FN01;
+        case 0x0002: return opcode == 0xF002 ? OP_F002 : OP_UNKNOWN;
+        case 0x0007: return OP_FX07;
+        case 0x000A: return OP_FX0A;
+        case 0x0015: return OP_FX15;
+        case 0x0018: return OP_FX18;
+        case 0x001E: return OP_FX1E;
+        case 0x0029: return OP_FX29;
+        case 0x0030: return OP_FX30;
+        case 0x0033: return OP_FX33;
+        case 0x003A: return OP_FX3A;
+        case 0x0055: return OP_FX55;
+        case 0x0065: return OP_FX65;
+        default: return OP_UNKNOWN;
+        }
+    }
+}
+
+static int op_depends_on_quirks(uint8_t op)
+{
+    // whether the quirk profiles (enum Sea8Quirks) disagree on this instruction
+    switch (op) {
+    case OP_8XY1:
+    case OP_8XY2:
+    case OP_8XY3:
+    case OP_8XY6:
+    case OP_8XYE:
+    case OP_BNNN:
+    case OP_DXYN:
+    case OP_FX55:
+    case OP_FX65:
+    case OP_ANNN_DXYN:
+    case OP_00CN:
+    case OP_00FB:
+    case OP_00FC:
+    case OP_00FD:
+    case OP_00FE:
+    case OP_00FF:
+    case OP_FX30:
+    // XO-CHIP: skips step over F000 NNNN, 00E0 clears the
+    // selected planes, and its own instructions
+    case OP_3XNN:
+    case OP_4XNN:
+    case OP_5XY0:
+    case OP_9XY0:
+    case OP_EX9E:
+    case OP_EXA1:
+    case OP_00E0:
+    case OP_00DN:
+    case OP_5XY2:
+    case OP_5XY3:
+    case OP_F000:
+    case OP_FN01:
+    case OP_F002:
+    case OP_FX3A:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static struct Instr decode_instr(uint16_t opcode)
+{
+    struct Instr instr = {
+        .op = decode_op(opcode),
+        .x = (opcode & 0x0F00) >> 8,
+        .y = (opcode & 0x00F0) >> 4,
+        .n = opcode & 0x000F,
+        .nn = opcode & 0x00FF,
+        .nnn = opcode & 0x0FFF,
+    };
+    return instr;
+}
+
+#ifdef SEA8_PROFILE
+// the opcode mix in sea8_profile_report
+static const char* const op_names[OP_COUNT] = {
+    [OP_UNKNOWN] = "????",
+    [OP_00E0] = "00E0",
+    [OP_00EE] = "00EE",
+    [OP_00CN] = "00CN",
+    [OP_00DN] = "00DN",
+    [OP_00FB] = "00FB",
+    [OP_00FC] = "00FC",
+    [OP_00FD] = "00FD",
+    [OP_00FE] = "00FE",
+    [OP_00FF] = "00FF",
+    [OP_1NNN] = "1NNN",
+    [OP_2NNN] = "2NNN",
+    [OP_3XNN] = "3XNN",
+    [OP_4XNN] = "4XNN",
+    [OP_5XY0] = "5XY0",
+    [OP_5XY2] = "5XY2",
+    [OP_5XY3] = "5XY3",
+    [OP_6XNN] = "6XNN",
+    [OP_7XNN] = "7XNN",
+    [OP_8XY0] = "8XY0",
+    [OP_8XY1] = "8XY1",
+    [OP_8XY2] = "8XY2",
+    [OP_8XY3] = "8XY3",
+    [OP_8XY4] = "8XY4",
+    [OP_8XY5] = "8XY5",
+    [OP_8XY6] = "8XY6",
+    [OP_8XY7] = "8XY7",
+    [OP_8XYE] = "8XYE",
+    [OP_9XY0] = "9XY0",
+    [OP_ANNN] = "ANNN",
+    [OP_BNNN] = "BNNN",
+    [OP_CXNN] = "CXNN",
+    [OP_DXYN] = "DXYN",
+    [OP_EX9E] = "EX9E",
+    [OP_EXA1] = "EXA1",
+    [OP_F000] = "F000",
+    [OP_FN01] = "FN01",
+    [OP_F002] = "F002",
+    [OP_FX07] = "FX07",
+    [OP_FX0A] = "FX0A",
+    [OP_FX15] = "FX15",
+    [OP_FX18] = "FX18",
+    [OP_FX1E] = "FX1E",
+    [OP_FX29] = "FX29",
+    [OP_FX30] = "FX30",
+    [OP_FX33] = "FX33",
+    [OP_FX3A] = "FX3A",
+    [OP_FX55] = "FX55",
+    [OP_FX65] = "FX65",
+    [OP_ANNN_DXYN] = "ANNN+DXYN",
+    [OP_6XNN_6YNN] = "6XNN+6YNN",
+    [OP_3XNN_1NNN] = "3XNN+1NNN",
+    [OP_4XNN_1NNN] = "4XNN+1NNN",
+    [OP_7XNN_3XNN_1NNN] = "7XNN+3XNN+1NNN",
+    [OP_7XNN_4XNN_1NNN] = "7XNN+4XNN+1NNN",
+};
+#endif
+
+void sea8_disassemble(uint16_t opcode, char* out, size_t size)
+{
+    // Cowgod style mnemonics
+    struct Instr ins = decode_instr(opcode);
+
+    switch (ins.op) {
+    case OP_00E0: snprintf(out, size, "CLS"); break;
+    case OP_00EE: snprintf(out, size, "RET"); break;
+    case OP_00CN: snprintf(out, size, "SCD %u", ins.n); break;
+    case OP_00DN: snprintf(out, size, "SCU %u", ins.n); break;
+    case OP_00FB: snprintf(out, size, "SCR"); break;
+    case OP_00FC: snprintf(out, size, "SCL"); break;
+    case OP_00FD: snprintf(out, size, "EXIT"); break;
+    case OP_00FE: snprintf(out, size, "LOW"); break;
+    case OP_00FF: snprintf(out, size, "HIGH"); break;
+    case OP_1NNN: snprintf(out, size, "JP 0x%03X", ins.nnn); break;
+    case OP_2NNN: snprintf(out, size, "CALL 0x%03X", ins.nnn); break;
+    case OP_3XNN: snprintf(out, size, "SE V%X, 0x%02X", ins.x, ins.nn); break;
+    case OP_4XNN: snprintf(out, size, "SNE V%X, 0x%02X", ins.x, ins.nn); break;
+    case OP_5XY0: snprintf(out, size, "SE V%X, V%X", ins.x, ins.y); break;
+    case OP_5XY2: snprintf(out, size, "SAVE V%X-V%X", ins.x, ins.y); break;
+    case OP_5XY3: snprintf(out, size, "LOAD V%X-V%X", ins.x, ins.y); break;
+    case OP_6XNN: snprintf(out, size, "LD V%X, 0x%02X", ins.x, ins.nn); break;
+    case OP_7XNN: snprintf(out, size, "ADD V%X, 0x%02X", ins.x, ins.nn); break;
+    case OP_8XY0: snprintf(out, size, "LD V%X, V%X", ins.x, ins.y); break;
+    case OP_8XY1: snprintf(out, size, "OR V%X, V%X", ins.x, ins.y); break;
+    case OP_8XY2: snprintf(out, size, "AND V%X, V%X", ins.x, ins.y); break;
+    case OP_8XY3: snprintf(out, size, "XOR V%X, V%X", ins.x, ins.y); break;
+    case OP_8XY4: snprintf(out, size, "ADD V%X, V%X", ins.x, ins.y); break;
+    case OP_8XY5: snprintf(out, size, "SUB V%X, V%X", ins.x, ins.y); break;
+    case OP_8XY6: snprintf(out, size, "SHR V%X", ins.x); break;
+    case OP_8XY7: snprintf(out, size, "SUBN V%X, V%X", ins.x, ins.y); break;
+    case OP_8XYE: snprintf(out, size, "SHL V%X", ins.x); break;
+    case OP_9XY0: snprintf(out, size, "SNE V%X, V%X", ins.x, ins.y); break;
+    case OP_ANNN: snprintf(out, size, "LD I, 0x%03X", ins.nnn); break;
+    case OP_BNNN: snprintf(out, size, "JP V0, 0x%03X", ins.nnn); break;
+    case OP_CXNN: snprintf(out, size, "RND V%X, 0x%02X", ins.x, ins.nn); break;
+    case OP_DXYN: snprintf(out, size, "DRW V%X, V%X, %u", ins.x, ins.y, ins.n); break;
+    case OP_EX9E: snprintf(out, size, "SKP V%X", ins.x); break;
+    case OP_EXA1: snprintf(out, size, "SKNP V%X", ins.x); break;
+    case OP_F000: snprintf(out, size, "LD I, LONG"); break; // the address is the next word
+    case OP_FN01: snprintf(out, size, "PLANE %u", ins.x); break;
+    case OP_F002: snprintf(out, size, "AUDIO"); break;
+    case OP_FX07: snprintf(out, size, "LD V%X, DT", ins.x); break;
+    case OP_FX0A: snprintf(out, size, "LD V%X, K", ins.x); break;
+    case OP_FX15: snprintf(out, size, "LD DT, V%X", ins.x); break;
+    case OP_FX18: snprintf(out, size, "LD ST, V%X", ins.x); break;
+    case OP_FX1E: snprintf(out, size, "ADD I, V%X", ins.x); break;
+    case OP_FX29: snprintf(out, size, "LD F, V%X", ins.x); break;
+    case OP_FX30: snprintf(out, size, "LD HF, V%X", ins.x); break;
+    case OP_FX33: snprintf(out, size, "LD B, V%X", ins.x); break;
+    case OP_FX3A: snprintf(out, size, "PITCH V%X", ins.x); break;
+    case OP_FX55: snprintf(out, size, "LD [I], V%X", ins.x); break;
+    case OP_FX65: snprintf(out, size, "LD V%X, [I]", ins.x); break;
+    default: snprintf(out, size, "DW 0x%04X", opcode); break;
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// chip-8 data structure
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// mem is split into MEM_PAGE_SIZE pages that are shared between a machine and
+// its clones (sea8_clone) until one of them writes to a page, so a fork
+// costs the registers, the framebuffer and SEA8_PAGE_COUNT reference counts.
+// Each page carries the decoded instructions (and translated blocks) for its
+// bytes, so forks share those too.
+
+struct Sea8MemPage {
+    _Alignas(64) struct Instr decoded[MEM_PAGE_SIZE]; // one entry per address, jumps may target odd addresses
+    uint8_t bytes[MEM_PAGE_SIZE];
+    atomic_int refs; // clones may live on different batch worker threads
+};
+
+// XO-CHIP memory past SEA8_MEM_SIZE is data only (jumps are 12 bits), so it is
+// one plain block without decoded instructions, shared copy-on-write as a
+// whole. Only the XO-CHIP loop reaches it, through xo_read and xo_store.
+
+struct Sea8XoMem {
+    atomic_int refs;
+    uint8_t bytes[SEA8_XO_MEM_SIZE - SEA8_MEM_SIZE];
+};
+
+void sea8_seed(struct Sea8Machine* chip8, uint64_t seed)
+{
+    // one splitmix64 round, so nearby seeds (0, 1, 2, ...) give unrelated
+    // streams and the xorshift state is never zero
+    uint64_t z = seed + 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    z ^= z >> 31;
+    chip8->rng_state = z ? z : 1;
+}
+
+static uint8_t chip8_random_byte(struct Sea8Machine* chip8)
+{
+    // xorshift64*, per instance so machines can run on any thread
+    uint64_t x = chip8->rng_state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    chip8->rng_state = x;
+    return (x * 0x2545F4914F6CDD1DULL) >> 56;
+}
+
+static struct Sea8MemPage* page_new(void)
+{
+    // NULL when out of memory
+    struct Sea8MemPage* page = calloc(1, sizeof(*page));
+    if (page) {
+        atomic_init(&page->refs, 1);
+    }
+    return page;
+}
+
+static void page_release(struct Sea8MemPage* page)
+{
+    if (atomic_fetch_sub(&page->refs, 1) == 1) {
+        free(page);
+    }
+}
+
+static struct Sea8MemPage* chip8_own_page(struct Sea8Machine* chip8, size_t page)
+{
+    // copy-on-write, a page is only written in place by its only owner.
+    // NULL when the copy cannot be allocated, the machine then halts with
+    // SEA8_ERR_NO_MEMORY and the write is dropped
+
+    struct Sea8MemPage* shared = chip8->pages[page];
+    if (atomic_load(&shared->refs) == 1) {
+        return shared;
+    }
+
+    struct Sea8MemPage* copy = page_new();
+    if (!copy) {
+        chip8->error = SEA8_ERR_NO_MEMORY;
+        return NULL;
+    }
+    memcpy(copy->bytes, shared->bytes, sizeof(copy->bytes));
+    memcpy(copy->decoded, shared->decoded, sizeof(copy->decoded));
+    chip8->pages[page] = copy;
+    page_release(shared);
+    return copy;
+}
+
+uint8_t sea8_read(const struct Sea8Machine* chip8, size_t addr)
+{
+    addr &= SEA8_MEM_SIZE - 1;
+    return chip8->pages[addr / MEM_PAGE_SIZE]->bytes[addr % MEM_PAGE_SIZE];
+}
+
+static void xo_mem_release(struct Sea8XoMem* mem)
+{
+    if (mem && atomic_fetch_sub(&mem->refs, 1) == 1) {
+        free(mem);
+    }
+}
+
+static struct Sea8XoMem* chip8_own_xo_mem(struct Sea8Machine* chip8)
+{
+    // copy-on-write as for pages, a machine without one gets a zeroed block,
+    // NULL as in chip8_own_page
+    struct Sea8XoMem* shared = chip8->xo_mem;
+    if (shared && atomic_load(&shared->refs) == 1) {
+        return shared;
+    }
+
+    struct Sea8XoMem* copy = malloc(sizeof(*copy));
+    if (!copy) {
+        chip8->error = SEA8_ERR_NO_MEMORY;
+        return NULL;
+    }
+    atomic_init(&copy->refs, 1);
+    if (shared) {
+        memcpy(copy->bytes, shared->bytes, sizeof(copy->bytes));
+        xo_mem_release(shared);
+    } else {
+        memset(copy->bytes, 0, sizeof(copy->bytes));
+    }
+    chip8->xo_mem = copy;
+    return copy;
+}
+
+static uint8_t xo_read(const struct Sea8Machine* chip8, size_t addr)
+{
+    // the 64 KB XO-CHIP address space, addr wraps around
+    addr &= SEA8_XO_MEM_SIZE - 1;
+    if (addr < SEA8_MEM_SIZE) {
+        return sea8_read(chip8, addr);
+    }
+    return chip8->xo_mem ? chip8->xo_mem->bytes[addr - SEA8_MEM_SIZE] : 0;
+}
+
+static uint16_t chip8_opcode_at(const struct Sea8Machine* chip8, size_t addr)
+{
+    // the raw opcode at addr, an instruction at the last byte reads 0 after it
+    uint8_t lo = addr + 1 < SEA8_MEM_SIZE ? sea8_read(chip8, addr + 1) : 0;
+    return (sea8_read(chip8, addr) << 8) | lo;
+}
+
+static struct Instr fuse_instr(const struct Sea8Machine* chip8, size_t addr)
+{
+    // The decode table entry for addr: a superinstruction when the
+    // instructions at addr and the following one or two addresses form one,
+    // else the plain instruction. A superinstruction keeps the operands of
+    // its first instruction where they are, so running only the first one
+    // (at the end of a budget) needs no other decode. The others go into
+    // fields the first one does not use:
+    //
+    //   ANNN+DXYN       nnn = ANNN, x y n = DXYN
+    //   6XNN+6YNN       x nn = first, y = second X, n = second NN
+    //   3XNN/4XNN+1NNN  x nn = skip, nnn = jump target
+    //   7XNN+3XNN/4XNN+1NNN (same X)  x nn = add, n = skip NN, nnn = jump target
+    //
+    // Only the entry at addr is fused, a jump or skip to addr + 2 still finds
+    // the plain instruction there, so nothing can enter a fused sequence in
+    // the middle.
+
+    struct Instr first = decode_instr(chip8_opcode_at(chip8, addr));
+    if (addr + 6 > SEA8_MEM_SIZE) {
+        return first;
+    }
+    struct Instr second = decode_instr(chip8_opcode_at(chip8, addr + 2));
+    struct Instr third = decode_instr(chip8_opcode_at(chip8, addr + 4));
+
+    switch (first.op) {
+    case OP_ANNN:
+        if (second.op == OP_DXYN) {
+            second.op = OP_ANNN_DXYN;
+            second.nnn = first.nnn;
+            return second;
+        }
+        break;
+    case OP_6XNN:
+        if (second.op == OP_6XNN) {
+            first.op = OP_6XNN_6YNN;
+            first.y = second.x;
+            first.n = second.nn;
+        }
+        break;
+    case OP_3XNN:
+    case OP_4XNN:
+        if (second.op == OP_1NNN) {
+            first.op = first.op == OP_3XNN ? OP_3XNN_1NNN : OP_4XNN_1NNN;
+            first.nnn = second.nnn;
+        }
+        break;
+    case OP_7XNN:
+        if ((second.op == OP_3XNN || second.op == OP_4XNN) && second.x == first.x && third.op == OP_1NNN) {
+            first.op = second.op == OP_3XNN ? OP_7XNN_3XNN_1NNN : OP_7XNN_4XNN_1NNN;
+            first.n = second.nn;
+            first.nnn = third.nnn;
+        }
+        break;
+    default:
+        break;
+    }
+    return first;
+}
+
+static const struct Instr* chip8_instr_at(const struct Sea8Machine* chip8, size_t addr)
+{
+    // a pc that stepped or skipped past the end (or BNNN) wraps around
+    return &chip8->pages[(addr / MEM_PAGE_SIZE) % SEA8_PAGE_COUNT]->decoded[addr % MEM_PAGE_SIZE];
+}
+
+#ifdef SEA8_DYNAREC
+static int op_ends_block(uint8_t op)
+{
+    // anything that sets pc (jumps, calls, FX0A, the superinstructions that
+    // end in a jump) or stores to mem (the store may rewrite the block
+    // itself). The SCHIP and XO-CHIP instructions too, they report an unknown
+    // opcode (with its pc) in profiles without them. Skips, draws and the
+    // other superinstructions run inside a block, see SKIP and FUSED_STEP.
+
+    switch (op) {
+    case OP_3XNN_1NNN:
+    case OP_4XNN_1NNN:
+    case OP_7XNN_3XNN_1NNN:
+    case OP_7XNN_4XNN_1NNN:
+    case OP_1NNN:
+    case OP_2NNN:
+    case OP_00EE:
+    case OP_BNNN:
+    case OP_FX0A:
+    case OP_FX33:
+    case OP_FX55:
+    case OP_00CN:
+    case OP_00FB:
+    case OP_00FC:
+    case OP_00FD:
+    case OP_00FE:
+    case OP_00FF:
+    case OP_FX30:
+    case OP_00DN:
+    case OP_5XY2:
+    case OP_5XY3:
+    case OP_F000:
+    case OP_FN01:
+    case OP_F002:
+    case OP_FX3A:
+    case OP_UNKNOWN:
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+static void page_translate_blocks(struct Sea8MemPage* page, size_t first, size_t end)
+{
+    // A block is a straight-line run of pre-decoded instructions up to and
+    // including the first one that ends it, executed without per-instruction
+    // pc and budget bookkeeping. Blocks stay inside their page, so a store
+    // only ever invalidates blocks of the pages it touches. The block at
+    // offset o is one longer than the block at o + 2, which lets the
+    // translation run backwards over [first, end) in one pass.
+
+    for (size_t o = end; o-- > first;) {
+        if (op_ends_block(page->decoded[o].op) || o + 3 >= MEM_PAGE_SIZE) {
+            page->decoded[o].block_len = 1;
+        } else {
+            int len = 1 + page->decoded[o + 2].block_len;
+            page->decoded[o].block_len = len < BLOCK_MAX_LEN ? len : BLOCK_MAX_LEN;
+        }
+    }
+}
+#endif
+
+static int chip8_decode_range(struct Sea8Machine* chip8, size_t start, size_t end)
+{
+    // (re-)decode the instructions starting at addresses [start, end), the
+    // pages they live in become private to this machine
+
+    if (end > SEA8_MEM_SIZE) {
+        end = SEA8_MEM_SIZE;
+    }
+    int error = SEA8_OK;
+    for (size_t addr = start; addr < end; ++addr) {
+        struct Sea8MemPage* page = chip8_own_page(chip8, addr / MEM_PAGE_SIZE);
+        if (!page) {
+            error = SEA8_ERR_NO_MEMORY;
+            end = addr; // the blocks below still match what was decoded
+            break;
+        }
+        page->decoded[addr % MEM_PAGE_SIZE] = fuse_instr(chip8, addr);
+    }
+
+#ifdef SEA8_DYNAREC
+    // every block that contains a re-decoded instruction starts at most
+    // 2 * (BLOCK_MAX_LEN - 1) bytes before it, in the same page
+
+    for (size_t addr = start; addr < end; addr = (addr / MEM_PAGE_SIZE + 1) * MEM_PAGE_SIZE) {
+        size_t page_start = addr / MEM_PAGE_SIZE * MEM_PAGE_SIZE;
+        size_t page_end = page_start + MEM_PAGE_SIZE < end ? page_start + MEM_PAGE_SIZE : end;
+        size_t first = addr >= page_start + 2 * BLOCK_MAX_LEN ? addr - 2 * BLOCK_MAX_LEN + 2 : page_start;
+        page_translate_blocks(chip8->pages[addr / MEM_PAGE_SIZE], first - page_start, page_end - page_start);
+    }
+#endif
+    return error;
+}
+
+static int chip8_store(struct Sea8Machine* chip8, size_t addr, const uint8_t* data, size_t len)
+{
+    // every write to mem goes through here: copy-on-write, then keep the
+    // decode table in sync (entries up to DECODE_REACH bytes earlier read
+    // the first written byte) and mark the pages dirty for save states.
+    // Returns SEA8_ERR_NO_MEMORY if a page could not be copied.
+
+    size_t written = len;
+    for (size_t i = 0; i < len; ++i) {
+        size_t a = (addr + i) & (SEA8_MEM_SIZE - 1);
+        struct Sea8MemPage* page = chip8_own_page(chip8, a / MEM_PAGE_SIZE);
+        if (!page) {
+            written = i; // still decode what was written
+            break;
+        }
+        page->bytes[a % MEM_PAGE_SIZE] = data[i];
+        chip8->dirty_pages |= 1u << (a / MEM_PAGE_SIZE);
+    }
+
+    addr &= SEA8_MEM_SIZE - 1;
+    int error = chip8_decode_range(chip8, addr > DECODE_REACH ? addr - DECODE_REACH : 0, addr + written);
+    if (addr + written > SEA8_MEM_SIZE && error == SEA8_OK) {
+        error = chip8_decode_range(chip8, 0, addr + written - SEA8_MEM_SIZE); // wrapped around
+    }
+    return written < len ? SEA8_ERR_NO_MEMORY : error;
+}
+
+static int xo_store(struct Sea8Machine* chip8, size_t addr, const uint8_t* data, size_t len)
+{
+    // chip8_store for the 64 KB XO-CHIP address space, split into the runs
+    // below and above SEA8_MEM_SIZE
+    while (len > 0) {
+        addr &= SEA8_XO_MEM_SIZE - 1;
+        size_t end = addr < SEA8_MEM_SIZE ? SEA8_MEM_SIZE : SEA8_XO_MEM_SIZE;
+        size_t run = end - addr < len ? end - addr : len;
+        if (addr < SEA8_MEM_SIZE) {
+            if (chip8_store(chip8, addr, data, run) != SEA8_OK) {
+                return SEA8_ERR_NO_MEMORY;
+            }
+        } else {
+            struct Sea8XoMem* mem = chip8_own_xo_mem(chip8);
+            if (!mem) {
+                return SEA8_ERR_NO_MEMORY;
+            }
+            memcpy(&mem->bytes[addr - SEA8_MEM_SIZE], data, run);
+            chip8->xo_dirty = 1;
+        }
+        addr += run;
+        data += run;
+        len -= run;
+    }
+    return SEA8_OK;
+}
+
+int sea8_init_buffer(struct Sea8Machine* chip8, const uint8_t* program, size_t program_size, uint64_t seed)
+{
+    // copy the program into a zeroed mem image, an XO-CHIP program may go
+    // on past SEA8_MEM_SIZE (see sea8_set_quirks)
+
+    if (program_size > SEA8_XO_MEM_SIZE - SEA8_PROGRAM_START) {
+        return SEA8_ERR_ROM_TOO_LARGE;
+    }
+    size_t low_size = program_size < SEA8_MEM_SIZE - SEA8_PROGRAM_START ? program_size : SEA8_MEM_SIZE - SEA8_PROGRAM_START;
+    uint8_t image[SEA8_MEM_SIZE] = { 0 };
+    memcpy(&image[SEA8_PROGRAM_START], program, low_size);
+
+    chip8->xo_mem = NULL;
+    if (program_size > low_size) {
+        chip8->xo_mem = malloc(sizeof(*chip8->xo_mem));
+        if (!chip8->xo_mem) {
+            return SEA8_ERR_NO_MEMORY;
+        }
+        atomic_init(&chip8->xo_mem->refs, 1);
+        memset(chip8->xo_mem->bytes, 0, sizeof(chip8->xo_mem->bytes));
+        memcpy(chip8->xo_mem->bytes, program + low_size, program_size - low_size);
+    }
+
+    // load fontset into mem
+
+    uint8_t fontset[80] = {
+        0xF0, 0x90, 0x90, 0x90, 0xF0, // 0
+        0x20, 0x60, 0x20, 0x20, 0x70, // 1
+        0xF0, 0x10, 0xF0, 0x80, 0xF0, // 2
+        0xF0, 0x10, 0xF0, 0x10, 0xF0, // 3
+        0x90, 0x90, 0xF0, 0x10, 0x10, // 4
+        0xF0, 0x80, 0xF0, 0x10, 0xF0, // 5
+        0xF0, 0x80, 0xF0, 0x90, 0xF0, // 6
+        0xF0, 0x10, 0x20, 0x40, 0x40, // 7
+        0xF0, 0x90, 0xF0, 0x90, 0xF0, // 8
+        0xF0, 0x90, 0xF0, 0x10, 0xF0, // 9
+        0xF0, 0x90, 0xF0, 0x90, 0x90, // A
+        0xE0, 0x90, 0xE0, 0x90, 0xE0, // B
+        0xF0, 0x80, 0x80, 0x80, 0xF0, // C
+        0xE0, 0x90, 0x90, 0x90, 0xE0, // D
+        0xF0, 0x80, 0xF0, 0x80, 0xF0, // E
+        0xF0, 0x80, 0xF0, 0x80, 0x80, // F
+    };
+
+    memcpy(&image[FONTSET_START], fontset, 80);
+
+    // SCHIP 8x10 digits for FX30, A-F as in XO-CHIP
+
+    uint8_t big_fontset[160] = {
+        0xFF, 0xFF, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, // 0
+        0x18, 0x78, 0x78, 0x18, 0x18, 0x18, 0x18, 0x18, 0xFF, 0xFF, // 1
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // 2
+        0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 3
+        0xC3, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0x03, 0x03, // 4
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 5
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 6
+        0xFF, 0xFF, 0x03, 0x03, 0x06, 0x0C, 0x18, 0x18, 0x18, 0x18, // 7
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, // 8
+        0xFF, 0xFF, 0xC3, 0xC3, 0xFF, 0xFF, 0x03, 0x03, 0xFF, 0xFF, // 9
+        0x7E, 0xFF, 0xC3, 0xC3, 0xC3, 0xFF, 0xFF, 0xC3, 0xC3, 0xC3, // A
+        0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, 0xC3, 0xC3, 0xFC, 0xFC, // B
+        0x3C, 0xFF, 0xC3, 0xC0, 0xC0, 0xC0, 0xC0, 0xC3, 0xFF, 0x3C, // C
+        0xFC, 0xFE, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xC3, 0xFE, 0xFC, // D
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, // E
+        0xFF, 0xFF, 0xC0, 0xC0, 0xFF, 0xFF, 0xC0, 0xC0, 0xC0, 0xC0, // F
+    };
+
+    memcpy(&image[BIG_FONTSET_START], big_fontset, 160);
+
+    // split the image into pages and pre-decode every address
+
+    for (size_t page = 0; page < SEA8_PAGE_COUNT; ++page) {
+        chip8->pages[page] = page_new();
+        if (!chip8->pages[page]) {
+            while (page-- > 0) {
+                page_release(chip8->pages[page]);
+            }
+            xo_mem_release(chip8->xo_mem);
+            return SEA8_ERR_NO_MEMORY;
+        }
+        memcpy(chip8->pages[page]->bytes, &image[page * MEM_PAGE_SIZE], MEM_PAGE_SIZE);
+    }
+    chip8_decode_range(chip8, 0, SEA8_MEM_SIZE);
+
+    // init stack
+
+    stack_init(&chip8->stack);
+
+    // init other arrays
+
+    memset(chip8->gfx, 0, sizeof(chip8->gfx));
+    memset(chip8->V, 0, sizeof(chip8->V));
+    chip8->keys = 0;
+    chip8->prev_keys = 0;
+
+    // init other variables
+
+    chip8->pc = SEA8_PROGRAM_START;
+    chip8->I = 0;
+    chip8->delay_timer = 0;
+    chip8->sound_timer = 0;
+    chip8->dirty_pages = 0;
+    chip8->dirty_rows = ~0ull; // first frame draws the whole screen
+    chip8->instructions = 0;
+    chip8->idle = SEA8_IDLE_NONE;
+    chip8->error = SEA8_OK;
+    chip8->quirks = SEA8_QUIRKS_CHIP8;
+    chip8->hires = 0;
+    chip8->planes = 1;
+    chip8->xo_dirty = 0;
+    chip8->pitch = 64;
+    memset(chip8->audio_pattern, 0, sizeof(chip8->audio_pattern));
+    chip8->unknown_opcodes = 0;
+    chip8->unknown_opcode = 0;
+    chip8->unknown_pc = 0;
+
+    // seed random number generator
+
+    sea8_seed(chip8, seed);
+    return SEA8_OK;
+}
+
+void sea8_clone(struct Sea8Machine* dst, const struct Sea8Machine* src)
+{
+    // dst must not hold pages (fresh, or after sea8_free)
+    *dst = *src;
+    for (size_t page = 0; page < SEA8_PAGE_COUNT; ++page) {
+        atomic_fetch_add(&dst->pages[page]->refs, 1);
+    }
+    if (dst->xo_mem) {
+        atomic_fetch_add(&dst->xo_mem->refs, 1);
+    }
+}
+
+void sea8_free(struct Sea8Machine* chip8)
+{
+    for (size_t page = 0; page < SEA8_PAGE_COUNT; ++page) {
+        page_release(chip8->pages[page]);
+        chip8->pages[page] = NULL;
+    }
+    xo_mem_release(chip8->xo_mem);
+    chip8->xo_mem = NULL;
+}
+
+int sea8_rom_init(struct Sea8Rom* rom, const uint8_t* program, size_t size)
+{
+    rom->size = size;
+    return sea8_init_buffer(&rom->image, program, size, 0);
+}
+
+int sea8_rom_load(struct Sea8Rom* rom, const char* rom_path)
+{
+    // one byte more than fits is read so an oversized file is caught
+    // without asking for its size
+
+    size_t capacity = SEA8_XO_MEM_SIZE - SEA8_PROGRAM_START + 1;
+    uint8_t* program = malloc(capacity);
+    if (!program) {
+        return SEA8_ERR_NO_MEMORY;
+    }
+
+    FILE* file = fopen(rom_path, "rb");
+    if (!file) {
+        free(program);
+        return SEA8_ERR_OPEN;
+    }
+
+    size_t size = 0;
+    while (size < capacity) {
+        size_t got = fread(&program[size], 1, capacity - size, file);
+        if (got == 0) {
+            break; // end of file or error, told apart below
+        }
+        size += got;
+    }
+    int failed = ferror(file);
+    fclose(file);
+
+    int error = failed ? SEA8_ERR_READ : sea8_rom_init(rom, program, size);
+    free(program);
+    return error;
+}
+
+void sea8_rom_free(struct Sea8Rom* rom)
+{
+    sea8_free(&rom->image);
+}
+
+void sea8_init_rom(struct Sea8Machine* chip8, const struct Sea8Rom* rom, uint64_t seed)
+{
+    sea8_clone(chip8, &rom->image);
+    sea8_seed(chip8, seed);
+}
+
+static const char* const quirks_names[SEA8_QUIRKS_COUNT] = {
+    [SEA8_QUIRKS_CHIP8] = "chip8",
+    [SEA8_QUIRKS_SCHIP] = "schip",
+    [SEA8_QUIRKS_XOCHIP] = "xochip",
+};
+
+int sea8_quirks_from_name(const char* name)
+{
+    for (int q = 0; q < SEA8_QUIRKS_COUNT; ++q) {
+        if (strcmp(name, quirks_names[q]) == 0) {
+            return q;
+        }
+    }
+    return -1;
+}
+
+const char* sea8_quirks_name(int quirks)
+{
+    return quirks >= 0 && quirks < SEA8_QUIRKS_COUNT ? quirks_names[quirks] : "?";
+}
+
+int sea8_set_quirks(struct Sea8Machine* chip8, enum Sea8Quirks quirks)
+{
+    // bytes past SEA8_MEM_SIZE at this point are the program's own
+    if (chip8->xo_mem && quirks != SEA8_QUIRKS_XOCHIP) {
+        return SEA8_ERR_ROM_TOO_LARGE;
+    }
+    chip8->quirks = quirks;
+    return SEA8_OK;
+}
+
+void sea8_set_keys(struct Sea8Machine* chip8, uint16_t key_mask)
+{
+    // bit k of key_mask is key k, the previous state is kept for FX0A
+    chip8->prev_keys = chip8->keys;
+    chip8->keys = key_mask;
+}
+
+void sea8_update_timers(struct Sea8Machine* chip8)
+{
+    if (chip8->delay_timer > 0) {
+        chip8->delay_timer--;
+    }
+    if (chip8->sound_timer > 0) {
+        chip8->sound_timer--;
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// static analysis
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// A walk over every path from SEA8_PROGRAM_START, following jumps, calls (both
+// the target and the return) and both ways of every skip. Each pending
+// address carries the value I has on the way there, when an ANNN set it
+// and nothing since made it unknown, so the sprite, BCD and register
+// blocks read at a known I are marked as data. Every address is queued at
+// most once, whatever reaches it first decides its routine and I.
+//
+// BNNN jumps depend on V0 (VX with the SCHIP quirk) and are only flagged.
+// When NNN holds a run of 1NNN, the usual jump table, the entries are
+// walked as well.
+
+struct AnalysisItem {
+    uint16_t pc;
+    uint16_t routine;
+    int32_t I; // -1 unknown
+};
+
+struct AnalysisQueue {
+    struct AnalysisItem items[SEA8_MEM_SIZE];
+    size_t len;
+    uint8_t queued[SEA8_MEM_SIZE];
+};
+
+static void analysis_push(struct AnalysisQueue* queue, size_t pc, size_t routine, int32_t I)
+{
+    pc &= SEA8_MEM_SIZE - 1;
+    if (!queue->queued[pc]) {
+        queue->queued[pc] = 1;
+        queue->items[queue->len++] = (struct AnalysisItem) { pc, routine, I };
+    }
+}
+
+static void analysis_mark_data(struct Sea8RomAnalysis* analysis, int32_t I, size_t len)
+{
+    if (I < 0) {
+        return;
+    }
+    for (size_t b = 0; b < len; ++b) {
+        analysis->flags[(I + b) & (SEA8_MEM_SIZE - 1)] |= SEA8_ANALYSIS_DATA;
+    }
+}
+
+int sea8_analyze(const struct Sea8Machine* c8, struct Sea8RomAnalysis* analysis)
+{
+    // SEA8_ERR_NO_MEMORY (analysis untouched) if the work list cannot be allocated
+    struct AnalysisQueue* queue = calloc(1, sizeof(*queue));
+    if (!queue) {
+        return SEA8_ERR_NO_MEMORY;
+    }
+    memset(analysis, 0, sizeof(*analysis));
+    int xochip = c8->quirks == SEA8_QUIRKS_XOCHIP;
+    int keeps_i = c8->quirks == SEA8_QUIRKS_SCHIP;
+
+    analysis->flags[SEA8_PROGRAM_START] |= SEA8_ANALYSIS_CALL_TARGET;
+    analysis_push(queue, SEA8_PROGRAM_START, SEA8_PROGRAM_START, -1);
+    while (queue->len > 0) {
+        struct AnalysisItem item = queue->items[--queue->len];
+        size_t pc = item.pc;
+        size_t next = (pc + 2) & (SEA8_MEM_SIZE - 1);
+        int32_t I = item.I;
+        uint16_t opcode = chip8_opcode_at(c8, pc);
+        struct Instr ins = decode_instr(opcode);
+
+        analysis->flags[pc] |= SEA8_ANALYSIS_CODE | SEA8_ANALYSIS_INSTR;
+        analysis->flags[(pc + 1) & (SEA8_MEM_SIZE - 1)] |= SEA8_ANALYSIS_CODE;
+        analysis->routine[pc] = item.routine;
+
+        switch (ins.op) {
+        case OP_1NNN:
+            analysis->flags[ins.nnn] |= SEA8_ANALYSIS_JUMP_TARGET;
+            analysis_push(queue, ins.nnn, item.routine, I);
+            break;
+        case OP_2NNN:
+            analysis->flags[ins.nnn] |= SEA8_ANALYSIS_CALL_TARGET;
+            analysis_push(queue, ins.nnn, ins.nnn, I);
+            analysis_push(queue, next, item.routine, -1); // the call may change I
+            break;
+        case OP_00EE:
+        case OP_00FD:
+            break;
+        case OP_UNKNOWN:
+            // not code after all, or a path no run takes, unless a store
+            // at a known I patches it first (self-modifying code)
+            if (analysis->flags[pc] & SEA8_ANALYSIS_DATA) {
+                analysis_push(queue, next, item.routine, I);
+            }
+            break;
+        case OP_BNNN:
+            analysis->flags[pc] |= SEA8_ANALYSIS_INDIRECT;
+            analysis->indirect_jumps++;
+            for (size_t entry = ins.nnn; entry < SEA8_MEM_SIZE && entry < (size_t)ins.nnn + 2 * 128; entry += 2) {
+                if (decode_instr(chip8_opcode_at(c8, entry)).op != OP_1NNN) {
+                    break;
+                }
+                analysis->flags[entry] |= SEA8_ANALYSIS_JUMP_TARGET;
+                analysis_push(queue, entry, item.routine, I);
+            }
+            break;
+        case OP_3XNN:
+        case OP_4XNN:
+        case OP_5XY0:
+        case OP_9XY0:
+        case OP_EX9E:
+        case OP_EXA1:
+            {
+                int skip_long = xochip && chip8_opcode_at(c8, next) == 0xF000;
+                size_t skipped = (next + (skip_long ? 4 : 2)) & (SEA8_MEM_SIZE - 1);
+                analysis->flags[skipped] |= SEA8_ANALYSIS_JUMP_TARGET;
+                analysis_push(queue, next, item.routine, I);
+                analysis_push(queue, skipped, item.routine, I);
+            }
+            break;
+        case OP_ANNN:
+            analysis_push(queue, next, item.routine, ins.nnn);
+            break;
+        case OP_F000:
+            if (!xochip) {
+                analysis_push(queue, next, item.routine, I);
+                break;
+            }
+            // the address word is part of the instruction
+            analysis->flags[next] |= SEA8_ANALYSIS_CODE;
+            analysis->flags[(next + 1) & (SEA8_MEM_SIZE - 1)] |= SEA8_ANALYSIS_CODE;
+            I = chip8_opcode_at(c8, next);
+            analysis_push(queue, next + 2, item.routine, I < SEA8_MEM_SIZE ? I : -1);
+            break;
+        case OP_DXYN:
+            analysis_mark_data(analysis, I, ins.n ? ins.n : 32);
+            analysis_push(queue, next, item.routine, I);
+            break;
+        case OP_FX33:
+            analysis_mark_data(analysis, I, 3);
+            analysis_push(queue, next, item.routine, I);
+            break;
+        case OP_FX55:
+        case OP_FX65:
+            analysis_mark_data(analysis, I, ins.x + 1);
+            analysis_push(queue, next, item.routine, I < 0 || keeps_i ? I : I + ins.x + 1);
+            break;
+        case OP_5XY2:
+        case OP_5XY3:
+            analysis_mark_data(analysis, I, (ins.x > ins.y ? ins.x - ins.y : ins.y - ins.x) + 1);
+            analysis_push(queue, next, item.routine, I);
+            break;
+        case OP_F002:
+            analysis_mark_data(analysis, I, SEA8_AUDIO_PATTERN_SIZE);
+            analysis_push(queue, next, item.routine, I);
+            break;
+        case OP_FX1E:
+        case OP_FX29:
+        case OP_FX30:
+            analysis_push(queue, next, item.routine, -1);
+            break;
+        default:
+            analysis_push(queue, next, item.routine, I);
+            break;
+        }
+    }
+    free(queue);
+
+    for (int a = 0; a < SEA8_MEM_SIZE; ++a) {
+        analysis->code_bytes += (analysis->flags[a] & SEA8_ANALYSIS_CODE) != 0;
+        analysis->data_bytes += (analysis->flags[a] & (SEA8_ANALYSIS_CODE | SEA8_ANALYSIS_DATA)) == SEA8_ANALYSIS_DATA;
+    }
+    return SEA8_OK;
+}
+
+void sea8_analysis_print(FILE* out, const struct Sea8Machine* c8, const struct Sea8RomAnalysis* analysis, size_t end)
+{
+    // the listing of mem[SEA8_PROGRAM_START, end): instructions with labels,
+    // everything else as DB lines of up to 8 bytes, marked when no path
+    // reads them
+    size_t data = 0;
+    size_t unreached = 0;
+    for (size_t a = SEA8_PROGRAM_START; a < SEA8_MEM_SIZE; ++a) {
+        data += (analysis->flags[a] & (SEA8_ANALYSIS_CODE | SEA8_ANALYSIS_DATA)) == SEA8_ANALYSIS_DATA;
+        unreached += a < end && !analysis->flags[a];
+    }
+    fprintf(out, "; %zu code bytes, %zu data bytes, %zu unreached bytes, %zu indirect jumps\n",
+        analysis->code_bytes, data, unreached, analysis->indirect_jumps);
+
+    size_t a = SEA8_PROGRAM_START;
+    while (a < end) {
+        uint8_t flags = analysis->flags[a];
+        if (flags & SEA8_ANALYSIS_INSTR) {
+            if (flags & SEA8_ANALYSIS_CALL_TARGET) {
+                fprintf(out, "\nsub_%03zX:\n", a);
+            } else if (flags & SEA8_ANALYSIS_JUMP_TARGET) {
+                fprintf(out, "L_%03zX:\n", a);
+            }
+            uint16_t opcode = chip8_opcode_at(c8, a);
+            char text[32];
+            sea8_disassemble(opcode, text, sizeof(text));
+            if (opcode == 0xF000 && c8->quirks == SEA8_QUIRKS_XOCHIP) {
+                snprintf(text, sizeof(text), "LD I, LONG 0x%04X", chip8_opcode_at(c8, a + 2));
+            }
+            const char* note = flags & SEA8_ANALYSIS_INDIRECT ? "; indirect, the target depends on V0"
+                : flags & SEA8_ANALYSIS_DATA                   ? "; also read as data"
+                                                          : NULL;
+            if (note) {
+                fprintf(out, "    0x%03zX  %04X  %-20s %s\n", a, opcode, text, note);
+            } else {
+                fprintf(out, "    0x%03zX  %04X  %s\n", a, opcode, text);
+            }
+            a += opcode == 0xF000 && c8->quirks == SEA8_QUIRKS_XOCHIP ? 4 : 2;
+            continue;
+        }
+
+        // a run of bytes that are not the start of an instruction, in one
+        // class (data or unreached), 8 per line
+        int is_data = (flags & SEA8_ANALYSIS_DATA) != 0;
+        fprintf(out, "    0x%03zX  DB   ", a);
+        size_t count = 0;
+        while (a < end && count < 8 && !(analysis->flags[a] & SEA8_ANALYSIS_INSTR)
+            && ((analysis->flags[a] & SEA8_ANALYSIS_DATA) != 0) == is_data) {
+            fprintf(out, "%s0x%02X", count ? ", " : "", sea8_read(c8, a));
+            ++a;
+            ++count;
+        }
+        fprintf(out, "%s\n", is_data ? "" : " ; unreached");
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// profiling
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Built with SEA8_PROFILE, the interpreter counts every instruction it runs
+// per opcode class and per pc, and times chip8_draw_sprite and the whole
+// interpreter with the cycle counter. sea8_profile_report prints the result at
+// exit. Without the flag none of this is compiled in.
+
+uint64_t sea8_read_cycle_counter(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return 0; // no cycle counter, cycles/instruction is reported as 0
+#endif
+}
+
+#ifdef SEA8_PROFILE
+#define PROFILE_TOP_PCS 20
+
+struct Profile {
+    uint64_t op_counts[OP_COUNT];
+    uint64_t pc_counts[SEA8_MEM_SIZE];
+    uint64_t draw_calls;
+    uint64_t draw_cycles;
+    uint64_t emulate_cycles;
+};
+
+// one per process, counts from several batch worker threads are approximate
+static struct Profile profile;
+
+#define PROFILE_INSTR(pc, ins)                      \
+    do {                                            \
+        profile.op_counts[(ins)->op]++;             \
+        profile.pc_counts[(pc) & (SEA8_MEM_SIZE - 1)]++; \
+    } while (0)
+
+static int compare_op_counts(const void* a, const void* b)
+{
+    uint64_t x = profile.op_counts[*(const int*)a];
+    uint64_t y = profile.op_counts[*(const int*)b];
+    return (x < y) - (x > y); // most executed first
+}
+
+static int compare_pc_counts(const void* a, const void* b)
+{
+    uint64_t x = profile.pc_counts[*(const int*)a];
+    uint64_t y = profile.pc_counts[*(const int*)b];
+    return (x < y) - (x > y);
+}
+
+void sea8_profile_report(FILE* out, const struct Sea8Machine* c8)
+{
+    // c8 is only used to disassemble the hot pcs and may be NULL
+    uint64_t total = 0;
+    for (int op = 0; op < OP_COUNT; ++op) {
+        total += profile.op_counts[op];
+    }
+    if (total == 0) {
+        return;
+    }
+
+    fprintf(out, "\nprofile:      %llu dispatches (a superinstruction counts once)\n", (unsigned long long)total);
+
+    fprintf(out, "opcode mix:\n");
+    int ops[OP_COUNT];
+    for (int op = 0; op < OP_COUNT; ++op) {
+        ops[op] = op;
+    }
+    qsort(ops, OP_COUNT, sizeof(int), compare_op_counts);
+    for (int i = 0; i < OP_COUNT && profile.op_counts[ops[i]] > 0; ++i) {
+        uint64_t count = profile.op_counts[ops[i]];
+        fprintf(out, "  %-14s %14llu %6.2f%%\n", op_names[ops[i]], (unsigned long long)count, 100.0 * count / total);
+    }
+
+    fprintf(out, "hot pcs:\n");
+    static int pcs[SEA8_MEM_SIZE];
+    for (int pc = 0; pc < SEA8_MEM_SIZE; ++pc) {
+        pcs[pc] = pc;
+    }
+    qsort(pcs, SEA8_MEM_SIZE, sizeof(int), compare_pc_counts);
+
+    // each hot pc with the routine it belongs to (see sea8_analyze), and
+    // the time per routine, code the analysis did not reach (a BNNN
+    // target, say) counts as "?"
+    static struct Sea8RomAnalysis analysis;
+    int analyzed = c8 && sea8_analyze(c8, &analysis) == SEA8_OK;
+    for (int i = 0; i < PROFILE_TOP_PCS && profile.pc_counts[pcs[i]] > 0; ++i) {
+        uint64_t count = profile.pc_counts[pcs[i]];
+        char text[32] = "";
+        char routine[16] = "";
+        if (c8) {
+            sea8_disassemble(chip8_opcode_at(c8, pcs[i]), text, sizeof(text));
+        }
+        if (analyzed) {
+            if (analysis.flags[pcs[i]] & SEA8_ANALYSIS_INSTR) {
+                snprintf(routine, sizeof(routine), "sub_%03X", analysis.routine[pcs[i]]);
+            } else {
+                snprintf(routine, sizeof(routine), "?");
+            }
+        }
+        fprintf(out, "  0x%03X %14llu %6.2f%%  %-8s  %s\n", pcs[i], (unsigned long long)count, 100.0 * count / total, routine, text);
+    }
+
+    if (analyzed) {
+        fprintf(out, "hot routines:\n");
+        static uint64_t routine_counts[SEA8_MEM_SIZE + 1]; // SEA8_MEM_SIZE: not reached by the analysis
+        memset(routine_counts, 0, sizeof(routine_counts));
+        for (int pc = 0; pc < SEA8_MEM_SIZE; ++pc) {
+            int routine = analysis.flags[pc] & SEA8_ANALYSIS_INSTR ? analysis.routine[pc] : SEA8_MEM_SIZE;
+            routine_counts[routine] += profile.pc_counts[pc];
+        }
+        for (int i = 0; i < PROFILE_TOP_PCS; ++i) {
+            int best = 0;
+            for (int r = 1; r <= SEA8_MEM_SIZE; ++r) {
+                best = routine_counts[r] > routine_counts[best] ? r : best;
+            }
+            if (routine_counts[best] == 0) {
+                break;
+            }
+            char name[16] = "?";
+            if (best < SEA8_MEM_SIZE) {
+                snprintf(name, sizeof(name), "sub_%03X", best);
+            }
+            fprintf(out, "  %-8s %14llu %6.2f%%\n", name, (unsigned long long)routine_counts[best], 100.0 * routine_counts[best] / total);
+            routine_counts[best] = 0;
+        }
+    }
+
+    fprintf(out, "draw:         %llu calls, %.1f%% of interpreter cycles, %.0f cycles/call\n",
+        (unsigned long long)profile.draw_calls,
+        profile.emulate_cycles ? 100.0 * profile.draw_cycles / profile.emulate_cycles : 0.0,
+        profile.draw_calls ? (double)profile.draw_cycles / profile.draw_calls : 0.0);
+}
+#else
+#define PROFILE_INSTR(pc, ins) ((void)0)
+#endif
+
+uint8_t sea8_gfx_pixel(const uint64_t* gfx, int x, int y)
+{
+    const uint64_t* row = &gfx[SEA8_GFX_INDEX(y, 0) + x / 64];
+    unsigned shift = 63 - x % 64;
+    return ((row[0] >> shift) & 1) | ((row[SEA8_GFX_WORDS] >> shift) & 1) << 1;
+}
+
+static void chip8_draw_sprite(struct Sea8Machine* c8, uint8_t x, uint8_t y, uint8_t n)
+{
+#ifdef SEA8_PROFILE
+    uint64_t draw_start = sea8_read_cycle_counter();
+#endif
+    uint8_t max_rows = n < SEA8_SCREEN_HEIGHT - y ? n : SEA8_SCREEN_HEIGHT - y;
+    uint64_t collision = 0;
+
+    for (uint8_t row = 0; row < max_rows; ++row) {
+        // sprite byte moved to the top of the row word and then right by x,
+        // columns past the right edge fall off the end (clipping)
+        uint64_t sprite_row = ((uint64_t)sea8_read(c8, c8->I + row) << 56) >> x;
+        collision |= c8->gfx[SEA8_GFX_INDEX(y + row, 0)] & sprite_row;
+        c8->gfx[SEA8_GFX_INDEX(y + row, 0)] ^= sprite_row;
+        c8->dirty_rows |= (uint64_t)(sprite_row != 0) << (y + row);
+    }
+
+    c8->V[0xF] = collision != 0;
+
+#ifdef SEA8_PROFILE
+    profile.draw_calls++;
+    profile.draw_cycles += sea8_read_cycle_counter() - draw_start;
+#endif
+}
+
+static uint64_t gfx_xor_row(uint64_t* row, int words, uint64_t bits, unsigned x, int wrap)
+{
+    // XOR the left aligned bits into a row of words at column x, returns the
+    // pixels that were already set. What passes the last word falls off, or
+    // wraps to the first one.
+    unsigned word = x / 64;
+    unsigned shift = x % 64;
+    uint64_t part = bits >> shift;
+    uint64_t spill = shift ? bits << (64 - shift) : 0;
+
+    uint64_t collision = row[word] & part;
+    row[word] ^= part;
+    if (word + 1 < (unsigned)words) {
+        collision |= row[word + 1] & spill;
+        row[word + 1] ^= spill;
+    } else if (wrap) {
+        collision |= row[0] & spill;
+        row[0] ^= spill;
+    }
+    return collision;
+}
+
+static void chip8_draw_sprite_large(struct Sea8Machine* c8, uint8_t vx, uint8_t vy, uint8_t n, int xochip)
+{
+    // 128x64 mode, DXY0 (16x16 sprite, two bytes per row) in either mode,
+    // and every XO-CHIP sprite: those wrap around the edges, read the 64 KB
+    // memory and draw one sprite per selected plane, the next plane's right
+    // after the previous one. VF is 1 on any collision, not the SCHIP 1.1
+    // count of rows. The 8 pixel wide sprites of 64x32 mode, by far the most
+    // common, take the single word path above instead.
+#ifdef SEA8_PROFILE
+    uint64_t draw_start = sea8_read_cycle_counter();
+#endif
+    int width = SEA8_GFX_WIDTH(c8->hires);
+    int height = SEA8_GFX_HEIGHT(c8->hires);
+    int words = c8->hires ? SEA8_GFX_WORDS : 1;
+    int wide = n == 0;
+    int rows = wide ? 16 : n;
+    unsigned x = vx & (width - 1);
+    int y = vy & (height - 1);
+    size_t addr = c8->I;
+    uint64_t collision = 0;
+
+    for (int plane = 0; plane < SEA8_PLANE_COUNT; ++plane) {
+        if (!(c8->planes >> plane & 1)) {
+            continue;
+        }
+        for (int row = 0; row < rows; ++row) {
+            int gy = y + row;
+            if (gy >= height) {
+                if (!xochip) {
+                    break;
+                }
+                gy -= height;
+            }
+            uint64_t bits;
+            if (xochip) {
+                bits = wide
+                    ? (uint64_t)((xo_read(c8, addr + 2 * row) << 8) | xo_read(c8, addr + 2 * row + 1)) << 48
+                    : (uint64_t)xo_read(c8, addr + row) << 56;
+            } else {
+                bits = wide
+                    ? (uint64_t)((sea8_read(c8, addr + 2 * row) << 8) | sea8_read(c8, addr + 2 * row + 1)) << 48
+                    : (uint64_t)sea8_read(c8, addr + row) << 56;
+            }
+            collision |= gfx_xor_row(&c8->gfx[SEA8_GFX_INDEX(gy, plane)], words, bits, x, xochip);
+            c8->dirty_rows |= (uint64_t)(bits != 0) << gy;
+        }
+        addr += wide ? 32 : n;
+    }
+
+    c8->V[0xF] = collision != 0;
+
+#ifdef SEA8_PROFILE
+    profile.draw_calls++;
+    profile.draw_cycles += sea8_read_cycle_counter() - draw_start;
+#endif
+}
+
+// SCHIP and XO-CHIP scrolling, in pixels of the current resolution (64x32
+// mode moves whole low resolution pixels, as on XO-CHIP), of the selected
+// planes only. Rows are runs of words, so a vertical scroll moves words and
+// a horizontal one shifts each row's words with the carry between them.
+
+static void chip8_scroll_vertical(struct Sea8Machine* c8, int n)
+{
+    // 00CN down (n > 0), XO-CHIP 00DN up (n < 0). 00C0/00D0 change nothing
+    // (and a row must not be copied onto itself)
+    if (n == 0) {
+        return;
+    }
+    int height = SEA8_GFX_HEIGHT(c8->hires);
+
+    for (int plane = 0; plane < SEA8_PLANE_COUNT; ++plane) {
+        if (!(c8->planes >> plane & 1)) {
+            continue;
+        }
+        if (n > 0) {
+            for (int y = height - 1; y >= 0; --y) {
+                uint64_t* row = &c8->gfx[SEA8_GFX_INDEX(y, plane)];
+                if (y >= n) {
+                    memcpy(row, &c8->gfx[SEA8_GFX_INDEX(y - n, plane)], SEA8_GFX_WORDS * sizeof(uint64_t));
+                } else {
+                    memset(row, 0, SEA8_GFX_WORDS * sizeof(uint64_t));
+                }
+            }
+        } else {
+            for (int y = 0; y < height; ++y) {
+                uint64_t* row = &c8->gfx[SEA8_GFX_INDEX(y, plane)];
+                if (y - n < height) {
+                    memcpy(row, &c8->gfx[SEA8_GFX_INDEX(y - n, plane)], SEA8_GFX_WORDS * sizeof(uint64_t));
+                } else {
+                    memset(row, 0, SEA8_GFX_WORDS * sizeof(uint64_t));
+                }
+            }
+        }
+    }
+    c8->dirty_rows = ~0ull;
+}
+
+static void chip8_scroll_sideways(struct Sea8Machine* c8, int right)
+{
+    // 00FB (right) and 00FC (left), 4 pixels
+    int height = SEA8_GFX_HEIGHT(c8->hires);
+    int words = c8->hires ? SEA8_GFX_WORDS : 1;
+
+    for (int plane = 0; plane < SEA8_PLANE_COUNT; ++plane) {
+        if (!(c8->planes >> plane & 1)) {
+            continue;
+        }
+        for (int y = 0; y < height; ++y) {
+            uint64_t* row = &c8->gfx[SEA8_GFX_INDEX(y, plane)];
+            if (right) {
+                for (int w = words - 1; w > 0; --w) {
+                    row[w] = (row[w] >> 4) | (row[w - 1] << 60);
+                }
+                row[0] >>= 4;
+            } else {
+                for (int w = 0; w < words - 1; ++w) {
+                    row[w] = (row[w] << 4) | (row[w + 1] >> 60);
+                }
+                row[words - 1] <<= 4;
+            }
+        }
+    }
+    c8->dirty_rows = ~0ull;
+}
+
+static void chip8_clear_planes(struct Sea8Machine* c8)
+{
+    // XO-CHIP 00E0, only the selected planes
+    for (int y = 0; y < SEA8_HIRES_HEIGHT; ++y) {
+        for (int plane = 0; plane < SEA8_PLANE_COUNT; ++plane) {
+            if (c8->planes >> plane & 1) {
+                memset(&c8->gfx[SEA8_GFX_INDEX(y, plane)], 0, SEA8_GFX_WORDS * sizeof(uint64_t));
+            }
+        }
+    }
+    c8->dirty_rows = ~0ull;
+}
+
+static int chip8_idle_skip(struct Sea8Machine* c8, size_t jump_pc, int budget_left)
+{
+    // called after a jump from jump_pc to c8->pc, returns how many of the
+    // remaining instructions are whole iterations of an idle loop
+    size_t target = c8->pc;
+
+    if (target == jump_pc) {
+        c8->idle = SEA8_IDLE_INPUT;
+        return budget_left;
+    }
+
+    if (target + 4 == jump_pc && c8->delay_timer != 0 && budget_left >= 3) {
+        // raw opcodes, the decoded test is usually fused with the jump
+        struct Instr poll = decode_instr(chip8_opcode_at(c8, target));
+        struct Instr test = decode_instr(chip8_opcode_at(c8, target + 2));
+        if (poll.op == OP_FX07 && test.op == OP_3XNN && test.x == poll.x && test.nn == 0) {
+            // the first iteration may change VX, all later ones are the same
+            c8->V[poll.x] = c8->delay_timer;
+            c8->idle = SEA8_IDLE_TIMER;
+            return budget_left / 3 * 3;
+        }
+    }
+
+    return 0;
+}
+
+// The handlers below are shared by all dispatch engines. The default engine
+// is a switch inside the instruction loop. With SEA8_THREADED, each handler
+// fetches the next instruction and jumps straight to its handler through a
+// label table (GCC labels as values), so every handler ends in its own
+// indirect branch for the branch predictor to learn. SEA8_DYNAREC dispatches
+// the same way through translated blocks (see page_translate_blocks), with
+// pc and the budget updated once per block instead of per instruction.
+
+// BUDGET_LEFT() is the number of instructions still to run after the current
+// one, BUDGET_SKIP(n) drops n of them. The block engine may only use them in
+// handlers that end a block. FAULT(error) halts the machine with pc back on
+// the current instruction, which must not have changed anything yet (except
+// a store that ran out of memory halfway), and takes the instructions that
+// did not run off the count.
+
+#ifdef SEA8_THREADED
+#define ENGINE_NAME "threaded"
+#define BUDGET_LEFT() remaining
+#define BUDGET_SKIP(count) (remaining -= (count))
+#define OP(op) L_##op:
+#define DISPATCH()                          \
+    do {                                    \
+        if (remaining-- <= 0) {             \
+            return SEA8_OK;                 \
+        }                                   \
+        ins = chip8_instr_at(c8, c8->pc);   \
+        PROFILE_INSTR(c8->pc, ins);         \
+        c8->pc += 2;                        \
+        goto* dispatch_table[ins->op];      \
+    } while (0)
+#elif defined(SEA8_DYNAREC)
+// steps to the next instruction of the block, or at the block's last one
+// starts the next block: its length comes off the budget up front and pc
+// moves past the last instruction, the only one that reads or writes it.
+// The budget may end a block early, it then ends after an instruction that
+// does not read pc either.
+#define ENGINE_NAME "dynarec"
+#define BUDGET_LEFT() remaining
+#define BUDGET_SKIP(count) (remaining -= (count))
+#define OP(op) L_##op:
+#define DISPATCH()                                                                     \
+    do {                                                                               \
+        if (ins == last) {                                                             \
+            if (remaining <= 0) {                                                      \
+                return SEA8_OK;                                                        \
+            }                                                                          \
+            ins = chip8_instr_at(c8, c8->pc);                                          \
+            int len = ins->block_len < remaining ? ins->block_len : remaining;         \
+            remaining -= len;                                                          \
+            last = ins + 2 * (len - 1);                                                \
+            c8->pc += 2 * (size_t)len;                                                 \
+        } else {                                                                       \
+            ins += 2;                                                                  \
+        }                                                                              \
+        PROFILE_INSTR(c8->pc - 2 - (size_t)(last - ins), ins);                         \
+        goto* dispatch_table[ins->op];                                                 \
+    } while (0)
+#else
+#define ENGINE_NAME "switch"
+#define BUDGET_LEFT() (instr_count - 1 - i)
+#define BUDGET_SKIP(count) (i += (count))
+#define OP(op) case op:
+#define DISPATCH() break
+#endif
+// the SCHIP and XO-CHIP instructions are unknown opcodes in profiles
+// without them
+#define SCHIP_ONLY()             \
+    do {                         \
+        if (!QUIRK_SCHIP) {      \
+            goto unknown_opcode; \
+        }                        \
+    } while (0)
+#define XOCHIP_ONLY()            \
+    do {                         \
+        if (!QUIRK_XOCHIP) {     \
+            goto unknown_opcode; \
+        }                        \
+    } while (0)
+// a skip steps over all of F000 NNNN on XO-CHIP
+#ifdef SEA8_DYNAREC
+// inside a block a skip steps over the next entry and gives its instruction
+// back to the budget, pc is already past the block (and F000 always ends
+// one). At the end of a block it moves pc like the other engines.
+#define SKIP()                                                                       \
+    do {                                                                             \
+        if (ins != last) {                                                           \
+            ins += 2;                                                                \
+            remaining++;                                                             \
+            if (QUIRK_XOCHIP && ins == last && ins->op == OP_F000) {                 \
+                c8->pc += 2;                                                         \
+            }                                                                        \
+        } else {                                                                     \
+            c8->pc += QUIRK_XOCHIP && chip8_instr_at(c8, c8->pc)->op == OP_F000 ? 4 : 2; \
+        }                                                                            \
+    } while (0)
+// a superinstruction inside a block runs its next instruction and then
+// steps over that entry, the block already took it off the budget
+#define FUSED_STEP() (ins != last || (BUDGET_LEFT() >= 1 && (BUDGET_SKIP(1), c8->pc += 2, 1)))
+#define FUSED_DISPATCH() do { if (ins != last) { ins += 2; } DISPATCH(); } while (0)
+#else
+#define SKIP() (c8->pc += QUIRK_XOCHIP && chip8_instr_at(c8, c8->pc)->op == OP_F000 ? 4 : 2)
+// a superinstruction runs its next instruction as long as the budget lasts
+#define FUSED_STEP() (BUDGET_LEFT() >= 1 && (BUDGET_SKIP(1), c8->pc += 2, 1))
+#define FUSED_DISPATCH() DISPATCH()
+#endif
+#define FAULT(code)                                      \
+    do {                                                 \
+        c8->pc -= 2;                                     \
+        c8->instructions -= (uint64_t)BUDGET_LEFT() + 1; \
+        c8->error = (code);                              \
+        c8->idle = SEA8_IDLE_INPUT;                           \
+        return c8->error;                                \
+    } while (0)
+
+const char* const sea8_engine_name = ENGINE_NAME;
+
+#ifdef SEA8_PROFILE
+// the plain entry point below becomes a static helper of the profiled one
+static int sea8_emulate_instructions_unprofiled(struct Sea8Machine* c8, int instr_count);
+#define sea8_emulate_instructions sea8_emulate_instructions_unprofiled
+#endif
+
+// one interpreter loop per quirk profile (see sea8_engine.inc)
+
+#define EMULATE_FUNCTION chip8_emulate_chip8
+#define QUIRK_SCHIP 0
+#define QUIRK_VF_RESET 1
+#define QUIRK_SHIFT_VX 0
+#define QUIRK_MEMORY_KEEPS_I 0
+#define QUIRK_JUMP_VX 0
+#define QUIRK_XOCHIP 0
+#include "sea8_engine.inc"
+#undef EMULATE_FUNCTION
+#undef QUIRK_VF_RESET
+#undef QUIRK_SHIFT_VX
+#undef QUIRK_MEMORY_KEEPS_I
+#undef QUIRK_JUMP_VX
+#undef QUIRK_XOCHIP
+#undef QUIRK_SCHIP
+
+#define EMULATE_FUNCTION chip8_emulate_schip
+#define QUIRK_SCHIP 1
+#define QUIRK_VF_RESET 0
+#define QUIRK_SHIFT_VX 1
+#define QUIRK_MEMORY_KEEPS_I 1
+#define QUIRK_JUMP_VX 1
+#define QUIRK_XOCHIP 0
+#include "sea8_engine.inc"
+#undef EMULATE_FUNCTION
+#undef QUIRK_VF_RESET
+#undef QUIRK_SHIFT_VX
+#undef QUIRK_MEMORY_KEEPS_I
+#undef QUIRK_JUMP_VX
+#undef QUIRK_XOCHIP
+#undef QUIRK_SCHIP
+
+#define EMULATE_FUNCTION chip8_emulate_xochip
+#define QUIRK_SCHIP 1
+#define QUIRK_VF_RESET 0
+#define QUIRK_SHIFT_VX 0
+#define QUIRK_MEMORY_KEEPS_I 0
+#define QUIRK_JUMP_VX 0
+#define QUIRK_XOCHIP 1
+#include "sea8_engine.inc"
+#undef EMULATE_FUNCTION
+#undef QUIRK_VF_RESET
+#undef QUIRK_SHIFT_VX
+#undef QUIRK_MEMORY_KEEPS_I
+#undef QUIRK_JUMP_VX
+#undef QUIRK_XOCHIP
+#undef QUIRK_SCHIP
+
+int sea8_emulate_instructions(struct Sea8Machine* c8, int instr_count)
+{
+    // returns c8->error, a halted machine does not run at all
+
+    if (c8->error != SEA8_OK) {
+        c8->idle = SEA8_IDLE_INPUT;
+        return c8->error;
+    }
+
+    // counted up front, every engine runs exactly instr_count instructions
+    // (idle loops included, see chip8_idle_skip) unless it faults
+    c8->instructions += (uint64_t)(instr_count > 0 ? instr_count : 0);
+    c8->idle = SEA8_IDLE_NONE;
+
+    switch (c8->quirks) {
+    case SEA8_QUIRKS_SCHIP:
+        return chip8_emulate_schip(c8, instr_count);
+    case SEA8_QUIRKS_XOCHIP:
+        return chip8_emulate_xochip(c8, instr_count);
+    default:
+        return chip8_emulate_chip8(c8, instr_count);
+    }
+}
+
+#ifdef SEA8_PROFILE
+#undef sea8_emulate_instructions
+
+int sea8_emulate_instructions(struct Sea8Machine* c8, int instr_count)
+{
+    uint64_t start = sea8_read_cycle_counter();
+    int error = sea8_emulate_instructions_unprofiled(c8, instr_count);
+    profile.emulate_cycles += sea8_read_cycle_counter() - start;
+    return error;
+}
+#endif
+
+#undef OP
+#undef BUDGET_LEFT
+#undef BUDGET_SKIP
+#undef DISPATCH
+#undef FAULT
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// lockstep lanes
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// SEA8_LANE_COUNT machines running the same ROM, with their registers stored as
+// one column per lane. When every lane is at the same pc with the same
+// opcode, register-only instructions run as one loop over the lanes, which
+// the compiler turns into vector code (AVX2/AVX-512 with -march=native).
+// Everything else, and every lane once they diverge, goes through the scalar
+// interpreter one lane at a time. mem, gfx, stack, keys and the RNG always
+// stay in each lane's own struct Sea8Machine.
+
+struct Chip8Lanes {
+    uint8_t V[SEA8_REGISTER_COUNT][SEA8_LANE_COUNT];
+    uint16_t pc[SEA8_LANE_COUNT];
+    uint16_t I[SEA8_LANE_COUNT];
+    uint8_t delay_timer[SEA8_LANE_COUNT];
+    uint8_t sound_timer[SEA8_LANE_COUNT];
+    struct Sea8Machine* machines[SEA8_LANE_COUNT];
+    uint64_t converged_steps; // instructions that ran on all lanes at once
+    uint64_t scalar_steps; // instructions that needed the per-lane fallback
+    struct Instr unfused; // first instruction of a converged superinstruction
+    uint8_t quirks; // of every lane, see lanes_step_converged
+    uint64_t halted; // bit l set = lane l has halted on a fault, it only runs scalar
+};
+
+static void lanes_load(struct Chip8Lanes* lanes, int lane)
+{
+    // copy a lane's registers out of its struct Sea8Machine
+    const struct Sea8Machine* c8 = lanes->machines[lane];
+
+    for (int r = 0; r < SEA8_REGISTER_COUNT; ++r) {
+        lanes->V[r][lane] = c8->V[r];
+    }
+    lanes->pc[lane] = c8->pc;
+    lanes->I[lane] = c8->I;
+    lanes->delay_timer[lane] = c8->delay_timer;
+    lanes->sound_timer[lane] = c8->sound_timer;
+}
+
+static void lanes_store(struct Chip8Lanes* lanes, int lane)
+{
+    // write a lane's registers back into its struct Sea8Machine
+    struct Sea8Machine* c8 = lanes->machines[lane];
+
+    for (int r = 0; r < SEA8_REGISTER_COUNT; ++r) {
+        c8->V[r] = lanes->V[r][lane];
+    }
+    c8->pc = lanes->pc[lane];
+    c8->I = lanes->I[lane];
+    c8->delay_timer = lanes->delay_timer[lane];
+    c8->sound_timer = lanes->sound_timer[lane];
+}
+
+static void lanes_init(struct Chip8Lanes* lanes, struct Sea8Machine* const* machines)
+{
+    memset(lanes, 0, sizeof(*lanes));
+    for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+        lanes->machines[l] = machines[l];
+        lanes_load(lanes, l);
+        lanes->halted |= (uint64_t)(machines[l]->error != SEA8_OK) << l;
+    }
+    lanes->quirks = machines[0]->quirks;
+}
+
+static void lanes_sync(struct Chip8Lanes* lanes)
+{
+    // make the struct Sea8Machine of every lane current, e.g. before reading results
+    for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+        lanes_store(lanes, l);
+    }
+}
+
+static void lanes_update_timers(struct Chip8Lanes* lanes)
+{
+    for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+        lanes->delay_timer[l] -= lanes->delay_timer[l] > 0;
+        lanes->sound_timer[l] -= lanes->sound_timer[l] > 0;
+    }
+}
+
+static const struct Instr* lanes_converged_instr(struct Chip8Lanes* lanes)
+{
+    // the shared instruction if all lanes are at the same pc with the same
+    // opcode bytes there (self-modifying stores can differ per lane), else
+    // NULL. Lanes step one instruction at a time, so a superinstruction is
+    // returned as its plain first instruction.
+
+    uint16_t pc = lanes->pc[0];
+    int same_pc = 1;
+    for (int l = 1; l < SEA8_LANE_COUNT; ++l) {
+        same_pc &= lanes->pc[l] == pc;
+    }
+    if (!same_pc || pc >= SEA8_MEM_SIZE - 1) {
+        return NULL;
+    }
+
+    // lanes forked from one machine usually still share the page
+    const struct Instr* ins0 = chip8_instr_at(lanes->machines[0], pc);
+    for (int l = 1; l < SEA8_LANE_COUNT; ++l) {
+        const struct Instr* ins = chip8_instr_at(lanes->machines[l], pc);
+        if (ins != ins0 && chip8_opcode_at(lanes->machines[l], pc) != chip8_opcode_at(lanes->machines[0], pc)) {
+            return NULL;
+        }
+    }
+
+    if (ins0->op >= OP_FUSED_FIRST) {
+        lanes->unfused = decode_instr(chip8_opcode_at(lanes->machines[0], pc));
+        return &lanes->unfused;
+    }
+    return ins0;
+}
+
+static void lanes_run_scalar(struct Chip8Lanes* lanes, int lane, int instr_count)
+{
+    lanes_store(lanes, lane);
+    sea8_emulate_instructions(lanes->machines[lane], instr_count);
+    lanes_load(lanes, lane);
+    lanes->halted |= (uint64_t)(lanes->machines[lane]->error != SEA8_OK) << lane;
+}
+
+static int lanes_step_converged(struct Chip8Lanes* lanes, const struct Instr* ins)
+{
+    // run ins on all lanes at once, returns 0 if it needs the scalar fallback
+
+    uint8_t* vx = lanes->V[ins->x];
+    const uint8_t* vy = lanes->V[ins->y];
+    uint8_t* vf = lanes->V[0xF];
+    uint8_t tmp[SEA8_LANE_COUNT];
+
+    // a halted lane must not run on, only the scalar path knows to stop it
+    if (lanes->halted) {
+        return 0;
+    }
+
+    // the handlers below have the CHIP-8 quirks, other profiles run the
+    // instructions that differ through their own scalar loop
+    if (lanes->quirks != SEA8_QUIRKS_CHIP8 && op_depends_on_quirks(ins->op)) {
+        return 0;
+    }
+
+    switch (ins->op) {
+    case OP_1NNN:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            lanes->pc[l] = ins->nnn;
+        }
+        return 1;
+    case OP_2NNN:
+        // a lane that would fault is left to halt in the scalar interpreter
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            if (lanes->machines[l]->stack.ptr >= SEA8_STACK_SIZE) {
+                return 0;
+            }
+        }
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            stack_push(&lanes->machines[l]->stack, lanes->pc[l] + 2);
+            lanes->pc[l] = ins->nnn;
+        }
+        return 1;
+    case OP_00EE:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            if (lanes->machines[l]->stack.ptr == 0) {
+                return 0;
+            }
+        }
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            size_t pc = 0;
+            stack_pop(&lanes->machines[l]->stack, &pc);
+            lanes->pc[l] = pc;
+        }
+        return 1;
+    case OP_3XNN:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            lanes->pc[l] += vx[l] == ins->nn ? 4 : 2;
+        }
+        return 1;
+    case OP_4XNN:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            lanes->pc[l] += vx[l] != ins->nn ? 4 : 2;
+        }
+        return 1;
+    case OP_5XY0:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            lanes->pc[l] += vx[l] == vy[l] ? 4 : 2;
+        }
+        return 1;
+    case OP_9XY0:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            lanes->pc[l] += vx[l] != vy[l] ? 4 : 2;
+        }
+        return 1;
+    case OP_6XNN:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            vx[l] = ins->nn;
+        }
+        break;
+    case OP_7XNN:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            vx[l] += ins->nn;
+        }
+        break;
+    case OP_8XY0:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            vx[l] = vy[l];
+        }
+        break;
+    case OP_8XY1:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            vx[l] |= vy[l];
+            vf[l] = 0;
+        }
+        break;
+    case OP_8XY2:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            vx[l] &= vy[l];
+            vf[l] = 0;
+        }
+        break;
+    case OP_8XY3:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            vx[l] ^= vy[l];
+            vf[l] = 0;
+        }
+        break;
+    case OP_8XY4:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            tmp[l] = vx[l] + vy[l] > 0xFF;
+            vx[l] += vy[l];
+        }
+        memcpy(vf, tmp, SEA8_LANE_COUNT);
+        break;
+    case OP_8XY5:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            tmp[l] = vx[l] >= vy[l];
+            vx[l] -= vy[l];
+        }
+        memcpy(vf, tmp, SEA8_LANE_COUNT);
+        break;
+    case OP_8XY6:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            tmp[l] = vy[l] & 0x1;
+            vx[l] = vy[l] >> 1;
+        }
+        memcpy(vf, tmp, SEA8_LANE_COUNT);
+        break;
+    case OP_8XY7:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            tmp[l] = vy[l] >= vx[l];
+            vx[l] = vy[l] - vx[l];
+        }
+        memcpy(vf, tmp, SEA8_LANE_COUNT);
+        break;
+    case OP_8XYE:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            tmp[l] = vy[l] >> 7;
+            vx[l] = vy[l] << 1;
+        }
+        memcpy(vf, tmp, SEA8_LANE_COUNT);
+        break;
+    case OP_ANNN:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            lanes->I[l] = ins->nnn;
+        }
+        break;
+    case OP_CXNN:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            vx[l] = chip8_random_byte(lanes->machines[l]) & ins->nn;
+        }
+        break;
+    case OP_FX07:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            vx[l] = lanes->delay_timer[l];
+        }
+        break;
+    case OP_FX15:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            lanes->delay_timer[l] = vx[l];
+        }
+        break;
+    case OP_FX18:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            lanes->sound_timer[l] = vx[l];
+        }
+        break;
+    case OP_FX1E:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            lanes->I[l] += vx[l];
+        }
+        break;
+    case OP_FX29:
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            lanes->I[l] = FONTSET_START + vx[l] * 5;
+        }
+        break;
+    case OP_DXYN:
+        // not vectorized, but needs only I in and VF out instead of a full
+        // round trip of the registers
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            struct Sea8Machine* c8 = lanes->machines[l];
+            c8->I = lanes->I[l];
+            if (c8->hires) {
+                chip8_draw_sprite_large(c8, vx[l], vy[l], ins->n, 0);
+            } else {
+                chip8_draw_sprite(c8, vx[l] & (SEA8_SCREEN_WIDTH - 1), vy[l] & (SEA8_SCREEN_HEIGHT - 1), ins->n);
+            }
+            vf[l] = c8->V[0xF];
+        }
+        break;
+    default:
+        return 0;
+    }
+
+    for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+        lanes->pc[l] += 2;
+    }
+    return 1;
+}
+
+static void lanes_emulate_instructions(struct Chip8Lanes* lanes, int instr_count)
+{
+    // scalar steps count themselves in sea8_emulate_instructions
+    int converged = 0;
+
+    for (int i = 0; i < instr_count; i++) {
+        const struct Instr* ins = lanes_converged_instr(lanes);
+
+        if (ins && lanes_step_converged(lanes, ins)) {
+            converged++;
+            continue;
+        }
+
+        if (ins) {
+            // converged, but the instruction touches per-lane memory or keys
+            for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+                lanes_run_scalar(lanes, l, 1);
+            }
+            lanes->scalar_steps++;
+            continue;
+        }
+
+        // diverged, run the rest of the call lane by lane and check again
+        // for convergence on the next call (usually the next frame)
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            lanes_run_scalar(lanes, l, instr_count - i);
+        }
+        lanes->scalar_steps += instr_count - i;
+        break;
+    }
+
+    lanes->converged_steps += converged;
+    for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+        lanes->machines[l]->instructions += converged;
+    }
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// save states
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+// Blob layout, all integers little endian:
+//
+//   "S8ST", version, 0, dirty page mask (u16)
+//   pc (u16), I (u16), delay timer, sound timer, stack pointer, hires
+//   V[16], stack[16] (u16 each), keys mask (u16), prev keys mask (u16), rng state (u64)
+//   gfx: SEA8_GFX_SIZE u64, in the order of struct Sea8Machine's gfx
+//   planes, pitch, xo_dirty, 0, audio pattern[16]
+//   one MEM_PAGE_SIZE block per bit set in the dirty page mask, lowest page first
+//   the XO-CHIP memory past SEA8_MEM_SIZE if xo_dirty is set
+//
+// Only pages (and XO-CHIP memory) written since chip8_init are stored.
+// Loading shares everything else with base, a freshly initialized machine
+// with the same ROM, so all states of one ROM can be restored against one
+// base.
+
+static void put_u16(uint8_t** p, uint16_t v)
+{
+    (*p)[0] = v & 0xFF;
+    (*p)[1] = v >> 8;
+    *p += 2;
+}
+
+static void put_u64(uint8_t** p, uint64_t v)
+{
+    for (int b = 0; b < 8; ++b) {
+        (*p)[b] = (v >> (8 * b)) & 0xFF;
+    }
+    *p += 8;
+}
+
+static uint16_t get_u16(const uint8_t** p)
+{
+    uint16_t v = (*p)[0] | ((*p)[1] << 8);
+    *p += 2;
+    return v;
+}
+
+static uint64_t get_u64(const uint8_t** p)
+{
+    uint64_t v = 0;
+    for (int b = 0; b < 8; ++b) {
+        v |= (uint64_t)(*p)[b] << (8 * b);
+    }
+    *p += 8;
+    return v;
+}
+
+size_t sea8_state_size(const struct Sea8Machine* c8)
+{
+    return SEA8_STATE_HEADER_SIZE + (size_t)__builtin_popcount(c8->dirty_pages) * MEM_PAGE_SIZE
+        + (c8->xo_dirty ? SEA8_XO_MEM_SIZE - SEA8_MEM_SIZE : 0);
+}
+
+size_t sea8_save_state(const struct Sea8Machine* c8, uint8_t* buf, size_t buf_size)
+{
+    // returns the number of bytes written, 0 if buf is too small
+
+    if (buf_size < sea8_state_size(c8)) {
+        return 0;
+    }
+
+    uint8_t* p = buf;
+    memcpy(p, STATE_MAGIC, 4);
+    p += 4;
+    *p++ = STATE_VERSION;
+    *p++ = 0;
+    put_u16(&p, c8->dirty_pages);
+
+    put_u16(&p, c8->pc);
+    put_u16(&p, c8->I);
+    *p++ = c8->delay_timer;
+    *p++ = c8->sound_timer;
+    *p++ = c8->stack.ptr;
+    *p++ = c8->hires;
+
+    memcpy(p, c8->V, SEA8_REGISTER_COUNT);
+    p += SEA8_REGISTER_COUNT;
+    for (int s = 0; s < SEA8_STACK_SIZE; ++s) {
+        put_u16(&p, c8->stack.data[s]);
+    }
+    put_u16(&p, c8->keys);
+    put_u16(&p, c8->prev_keys);
+    put_u64(&p, c8->rng_state);
+
+    for (int w = 0; w < SEA8_GFX_SIZE; ++w) {
+        put_u64(&p, c8->gfx[w]);
+    }
+    *p++ = c8->planes;
+    *p++ = c8->pitch;
+    *p++ = c8->xo_dirty;
+    *p++ = 0;
+    memcpy(p, c8->audio_pattern, SEA8_AUDIO_PATTERN_SIZE);
+    p += SEA8_AUDIO_PATTERN_SIZE;
+
+    for (int page = 0; page < SEA8_PAGE_COUNT; ++page) {
+        if (c8->dirty_pages & (1u << page)) {
+            memcpy(p, c8->pages[page]->bytes, MEM_PAGE_SIZE);
+            p += MEM_PAGE_SIZE;
+        }
+    }
+    if (c8->xo_dirty) {
+        memcpy(p, c8->xo_mem->bytes, SEA8_XO_MEM_SIZE - SEA8_MEM_SIZE);
+        p += SEA8_XO_MEM_SIZE - SEA8_MEM_SIZE;
+    }
+
+    return p - buf;
+}
+
+int sea8_load_state(struct Sea8Machine* c8, const struct Sea8Machine* base, const uint8_t* buf, size_t size)
+{
+    // returns SEA8_ERR_BAD_STATE (and c8 untouched) if buf is not a valid state,
+    // SEA8_ERR_NO_MEMORY (and c8 halted) if a page could not be copied
+
+    const uint8_t* p = buf;
+    if (size < SEA8_STATE_HEADER_SIZE || memcmp(p, STATE_MAGIC, 4) != 0 || p[4] != STATE_VERSION) {
+        return SEA8_ERR_BAD_STATE;
+    }
+    p += 6;
+    uint16_t pages = get_u16(&p);
+    const uint8_t* xo = buf + SEA8_STATE_HEADER_SIZE - SEA8_AUDIO_PATTERN_SIZE - 4; // planes, pitch, xo_dirty, 0
+    if (xo[0] > 3 || xo[2] > 1
+        || size != SEA8_STATE_HEADER_SIZE + (size_t)__builtin_popcount(pages) * MEM_PAGE_SIZE + (xo[2] ? SEA8_XO_MEM_SIZE - SEA8_MEM_SIZE : 0)) {
+        return SEA8_ERR_BAD_STATE;
+    }
+
+    uint16_t pc = get_u16(&p);
+    uint16_t I = get_u16(&p);
+    uint8_t delay_timer = *p++;
+    uint8_t sound_timer = *p++;
+    uint8_t stack_ptr = *p++;
+    uint8_t hires = *p++;
+    if (pc >= SEA8_MEM_SIZE || stack_ptr > SEA8_STACK_SIZE || hires > 1) {
+        return SEA8_ERR_BAD_STATE;
+    }
+
+    c8->pc = pc;
+    c8->I = I;
+    c8->delay_timer = delay_timer;
+    c8->sound_timer = sound_timer;
+    c8->stack.ptr = stack_ptr;
+    c8->hires = hires;
+
+    memcpy(c8->V, p, SEA8_REGISTER_COUNT);
+    p += SEA8_REGISTER_COUNT;
+    for (int s = 0; s < SEA8_STACK_SIZE; ++s) {
+        c8->stack.data[s] = get_u16(&p);
+    }
+    c8->keys = get_u16(&p);
+    c8->prev_keys = get_u16(&p);
+    c8->rng_state = get_u64(&p);
+
+    for (int w = 0; w < SEA8_GFX_SIZE; ++w) {
+        c8->gfx[w] = get_u64(&p);
+    }
+    c8->dirty_rows = ~0ull;
+    c8->planes = *p++;
+    c8->pitch = *p++;
+    uint8_t xo_dirty = *p++;
+    p++;
+    memcpy(c8->audio_pattern, p, SEA8_AUDIO_PATTERN_SIZE);
+    p += SEA8_AUDIO_PATTERN_SIZE;
+
+    // pages only dirty in c8 go back to sharing the base page, pages dirty
+    // in the state are stored from the blob, all others are equal to base
+    uint16_t restore = c8->dirty_pages & ~pages;
+    for (int page = 0; page < SEA8_PAGE_COUNT; ++page) {
+        if (restore & (1u << page)) {
+            page_release(c8->pages[page]);
+            c8->pages[page] = base->pages[page];
+            atomic_fetch_add(&c8->pages[page]->refs, 1);
+        }
+    }
+    for (int page = 0; page < SEA8_PAGE_COUNT; ++page) {
+        if (pages & (1u << page)) {
+            if (chip8_store(c8, page * MEM_PAGE_SIZE, p, MEM_PAGE_SIZE) != SEA8_OK) {
+                return SEA8_ERR_NO_MEMORY;
+            }
+            p += MEM_PAGE_SIZE;
+        }
+    }
+    for (int page = 1; page < SEA8_PAGE_COUNT; ++page) {
+        // the last entries of the page before a restored one read its first
+        // bytes, which are stale unless that page is base's as well
+        if ((restore & (1u << page)) && c8->pages[page - 1] != base->pages[page - 1]) {
+            if (chip8_decode_range(c8, page * MEM_PAGE_SIZE - DECODE_REACH, page * MEM_PAGE_SIZE) != SEA8_OK) {
+                return SEA8_ERR_NO_MEMORY;
+            }
+        }
+    }
+    c8->dirty_pages = pages;
+
+    if (xo_dirty) {
+        struct Sea8XoMem* mem = chip8_own_xo_mem(c8);
+        if (!mem) {
+            return SEA8_ERR_NO_MEMORY;
+        }
+        memcpy(mem->bytes, p, SEA8_XO_MEM_SIZE - SEA8_MEM_SIZE);
+    } else if (c8->xo_mem != base->xo_mem) {
+        xo_mem_release(c8->xo_mem);
+        c8->xo_mem = base->xo_mem;
+        if (c8->xo_mem) {
+            atomic_fetch_add(&c8->xo_mem->refs, 1);
+        }
+    }
+    c8->xo_dirty = xo_dirty;
+    c8->error = SEA8_OK;
+
+    return SEA8_OK;
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// batch runner
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+struct Sea8BatchInstance {
+    // slots start on a cache line, so no two workers share one
+    _Alignas(64) struct Sea8Machine c8;
+    const struct Sea8KeyEvent* script; // sorted by cycle, may be NULL
+    size_t script_len;
+    size_t script_pos;
+    uint16_t keys;
+    uint64_t cycles;
+};
+
+struct Sea8BatchWorker {
+    struct Sea8Batch* batch;
+    pthread_t thread;
+    size_t index;
+    atomic_size_t next_chunk; // shared with thieves, claimed with fetch_add
+    size_t end_chunk;
+    const struct BatchInit* init; // set until the worker has built its slots
+};
+
+struct BatchInit {
+    const struct Sea8Rom* rom;
+    const uint64_t* seeds;
+    const struct Sea8KeyEvent* const* scripts;
+    const size_t* script_lens;
+};
+
+static int get_core_count(void)
+{
+#ifdef _WIN32
+    const char* env = getenv("NUMBER_OF_PROCESSORS");
+    int cores = env ? atoi(env) : 1;
+#else
+    int cores = (int)sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+    return cores > 0 ? cores : 1;
+}
+
+static void batch_instance_poll_script(struct Sea8BatchInstance* bi)
+{
+    while (bi->script_pos < bi->script_len && bi->script[bi->script_pos].cycle <= bi->cycles) {
+        bi->keys = bi->script[bi->script_pos++].keys;
+    }
+    sea8_set_keys(&bi->c8, bi->keys);
+}
+
+static void batch_instance_run(struct Sea8BatchInstance* bi, uint64_t cycles)
+{
+    // same frame structure as the window loop: at every SEA8_INSTR_PER_FRAME
+    // boundary the keys are sampled (from the script) and the timers tick
+
+    uint64_t end = bi->cycles + cycles;
+
+    while (bi->cycles < end) {
+        if (bi->cycles % SEA8_INSTR_PER_FRAME == 0) {
+            batch_instance_poll_script(bi);
+            sea8_update_timers(&bi->c8);
+        }
+
+        uint64_t frame_end = bi->cycles - bi->cycles % SEA8_INSTR_PER_FRAME + SEA8_INSTR_PER_FRAME;
+        uint64_t stop = frame_end < end ? frame_end : end;
+        sea8_emulate_instructions(&bi->c8, (int)(stop - bi->cycles));
+        bi->cycles = stop;
+    }
+}
+
+static void batch_group_run(struct Sea8Batch* batch, struct Sea8BatchInstance* group, uint64_t cycles)
+{
+    // SEA8_LANE_COUNT instances with equal cycle counts, stepped in lockstep with
+    // the same frame structure as batch_instance_run
+
+    struct Sea8Machine* machines[SEA8_LANE_COUNT];
+    for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+        machines[l] = &group[l].c8;
+    }
+
+    struct Chip8Lanes lanes;
+    lanes_init(&lanes, machines);
+
+    uint64_t now = group[0].cycles;
+    uint64_t end = now + cycles;
+    int diverged_frames = 0;
+
+    while (now < end && diverged_frames < LANE_GIVE_UP_FRAMES) {
+        if (now % SEA8_INSTR_PER_FRAME == 0) {
+            for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+                batch_instance_poll_script(&group[l]);
+            }
+            lanes_update_timers(&lanes);
+        }
+
+        uint64_t frame_end = now - now % SEA8_INSTR_PER_FRAME + SEA8_INSTR_PER_FRAME;
+        uint64_t stop = frame_end < end ? frame_end : end;
+        uint64_t converged_before = lanes.converged_steps;
+        lanes_emulate_instructions(&lanes, (int)(stop - now));
+        diverged_frames = lanes.converged_steps == converged_before ? diverged_frames + 1 : 0;
+        now = stop;
+    }
+
+    lanes_sync(&lanes);
+    for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+        group[l].cycles = now;
+    }
+
+    // lanes that stay apart (e.g. after CXNN) are cheaper to run one by one,
+    // interleaving them only multiplies the cache footprint
+    if (now < end) {
+        for (int l = 0; l < SEA8_LANE_COUNT; ++l) {
+            batch_instance_run(&group[l], end - now);
+        }
+        lanes.scalar_steps += end - now;
+    }
+    atomic_fetch_add(&batch->converged_steps, lanes.converged_steps);
+    atomic_fetch_add(&batch->scalar_steps, lanes.scalar_steps);
+}
+
+static int batch_claim_chunk(struct Sea8BatchWorker* worker, size_t* chunk)
+{
+    size_t c = atomic_fetch_add(&worker->next_chunk, 1);
+    if (c >= worker->end_chunk) {
+        return 0;
+    }
+    *chunk = c;
+    return 1;
+}
+
+static void batch_worker_step(struct Sea8BatchWorker* worker)
+{
+    struct Sea8Batch* batch = worker->batch;
+    size_t chunk;
+
+    // own chunks first, then steal from the other workers, round robin
+    for (size_t w = 0; w < batch->worker_count; ++w) {
+        struct Sea8BatchWorker* victim = &batch->workers[(worker->index + w) % batch->worker_count];
+
+        while (batch_claim_chunk(victim, &chunk)) {
+            size_t first = chunk * BATCH_CHUNK;
+            size_t last = first + BATCH_CHUNK < batch->count ? first + BATCH_CHUNK : batch->count;
+            if (batch->lockstep) {
+                for (; first + SEA8_LANE_COUNT <= last; first += SEA8_LANE_COUNT) {
+                    batch_group_run(batch, &batch->instances[first], batch->step_cycles);
+                }
+            }
+            for (size_t i = first; i < last; ++i) {
+                batch_instance_run(&batch->instances[i], batch->step_cycles);
+            }
+        }
+    }
+}
+
+static void batch_worker_init(struct Sea8BatchWorker* worker)
+{
+    // each worker builds the chunks sea8_batch_step deals to it first, so the
+    // slots are first touched, and on NUMA systems placed, by their owner
+
+    struct Sea8Batch* batch = worker->batch;
+    const struct BatchInit* init = worker->init;
+    size_t chunks = (batch->count + BATCH_CHUNK - 1) / BATCH_CHUNK;
+    size_t first = chunks * worker->index / batch->worker_count * BATCH_CHUNK;
+    size_t last = chunks * (worker->index + 1) / batch->worker_count * BATCH_CHUNK;
+
+    for (size_t i = first; i < last && i < batch->count; ++i) {
+        struct Sea8BatchInstance* bi = &batch->instances[i];
+        memset(bi, 0, sizeof(*bi));
+        sea8_init_rom(&bi->c8, init->rom, init->seeds[i]);
+        bi->script = init->scripts ? init->scripts[i] : NULL;
+        bi->script_len = init->scripts ? init->script_lens[i] : 0;
+    }
+}
+
+static void* batch_worker_main(void* arg)
+{
+    struct Sea8BatchWorker* worker = arg;
+    struct Sea8Batch* batch = worker->batch;
+    uint64_t seen_generation = 0;
+
+    batch_worker_init(worker);
+    pthread_mutex_lock(&batch->lock);
+    worker->init = NULL;
+    if (--batch->running == 0) {
+        pthread_cond_signal(&batch->done);
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    for (;;) {
+        pthread_mutex_lock(&batch->lock);
+        while (!batch->shutdown && batch->generation == seen_generation) {
+            pthread_cond_wait(&batch->start, &batch->lock);
+        }
+        if (batch->shutdown) {
+            pthread_mutex_unlock(&batch->lock);
+            return NULL;
+        }
+        seen_generation = batch->generation;
+        pthread_mutex_unlock(&batch->lock);
+
+        batch_worker_step(worker);
+
+        pthread_mutex_lock(&batch->lock);
+        if (--batch->running == 0) {
+            pthread_cond_signal(&batch->done);
+        }
+        pthread_mutex_unlock(&batch->lock);
+    }
+}
+
+int sea8_batch_init(struct Sea8Batch* batch, const struct Sea8Rom* rom, size_t count, int threads,
+    const uint64_t* seeds, const struct Sea8KeyEvent* const* scripts, const size_t* script_lens)
+{
+    // seeds, scripts and script_lens are per instance, scripts may be NULL
+
+    memset(batch, 0, sizeof(*batch));
+
+    // one arena for all slots, aligned by hand (no aligned_alloc on MSVCRT)
+    // and left untouched here so the workers fault its pages in themselves
+    batch->arena = malloc(count * sizeof(struct Sea8BatchInstance) + 63);
+    if (!batch->arena) {
+        return SEA8_ERR_NO_MEMORY;
+    }
+    batch->instances = (struct Sea8BatchInstance*)(((uintptr_t)batch->arena + 63) & ~(uintptr_t)63);
+    batch->count = count;
+
+    batch->worker_count = threads > 0 ? (size_t)threads : (size_t)get_core_count();
+    batch->workers = calloc(batch->worker_count, sizeof(*batch->workers));
+    if (!batch->workers) {
+        free(batch->arena);
+        return SEA8_ERR_NO_MEMORY;
+    }
+
+    pthread_mutex_init(&batch->lock, NULL);
+    pthread_cond_init(&batch->start, NULL);
+    pthread_cond_init(&batch->done, NULL);
+
+    // every instance starts as a clone of the loaded ROM and shares its
+    // pages until it writes to them
+    struct BatchInit init = { rom, seeds, scripts, script_lens };
+    batch->running = batch->worker_count;
+    size_t started = 0;
+    for (; started < batch->worker_count; ++started) {
+        struct Sea8BatchWorker* worker = &batch->workers[started];
+        worker->batch = batch;
+        worker->index = started;
+        worker->init = &init;
+        if (pthread_create(&worker->thread, NULL, batch_worker_main, worker) != 0) {
+            break;
+        }
+    }
+
+    // the started workers still read init, wait for them either way
+    pthread_mutex_lock(&batch->lock);
+    batch->running -= batch->worker_count - started;
+    while (batch->running > 0) {
+        pthread_cond_wait(&batch->done, &batch->lock);
+    }
+    pthread_mutex_unlock(&batch->lock);
+
+    if (started < batch->worker_count) {
+        // only the slots of the started workers were built (see
+        // batch_worker_init), stop those workers and free just those slots
+        size_t chunks = (count + BATCH_CHUNK - 1) / BATCH_CHUNK;
+        size_t built = chunks * started / batch->worker_count * BATCH_CHUNK;
+        batch->count = built < count ? built : count;
+        batch->worker_count = started;
+        sea8_batch_free(batch);
+        return SEA8_ERR_THREAD;
+    }
+    return SEA8_OK;
+}
+
+void sea8_batch_step(struct Sea8Batch* batch, uint64_t cycles)
+{
+    // step every instance by cycles instructions, chunks are dealt out evenly
+    // and idle workers steal whatever is left from the busy ones
+
+    size_t chunks = (batch->count + BATCH_CHUNK - 1) / BATCH_CHUNK;
+
+    pthread_mutex_lock(&batch->lock);
+    for (size_t w = 0; w < batch->worker_count; ++w) {
+        atomic_store(&batch->workers[w].next_chunk, chunks * w / batch->worker_count);
+        batch->workers[w].end_chunk = chunks * (w + 1) / batch->worker_count;
+    }
+    batch->step_cycles = cycles;
+    batch->running = batch->worker_count;
+    batch->generation++;
+    pthread_cond_broadcast(&batch->start);
+    while (batch->running > 0) {
+        pthread_cond_wait(&batch->done, &batch->lock);
+    }
+    pthread_mutex_unlock(&batch->lock);
+}
+
+void sea8_batch_collect(const struct Sea8Batch* batch, size_t index, struct Sea8BatchResult* result)
+{
+    const struct Sea8BatchInstance* bi = &batch->instances[index];
+
+    memcpy(result->gfx, bi->c8.gfx, sizeof(result->gfx));
+    result->hires = bi->c8.hires;
+    memcpy(result->V, bi->c8.V, sizeof(result->V));
+    result->pc = bi->c8.pc;
+    result->I = bi->c8.I;
+    result->delay_timer = bi->c8.delay_timer;
+    result->sound_timer = bi->c8.sound_timer;
+    result->cycles = bi->cycles;
+    result->error = bi->c8.error;
+}
+
+void sea8_batch_free(struct Sea8Batch* batch)
+{
+    pthread_mutex_lock(&batch->lock);
+    batch->shutdown = 1;
+    pthread_cond_broadcast(&batch->start);
+    pthread_mutex_unlock(&batch->lock);
+
+    for (size_t w = 0; w < batch->worker_count; ++w) {
+        pthread_join(batch->workers[w].thread, NULL);
+    }
+
+    pthread_mutex_destroy(&batch->lock);
+    pthread_cond_destroy(&batch->start);
+    pthread_cond_destroy(&batch->done);
+    for (size_t i = 0; i < batch->count; ++i) {
+        sea8_free(&batch->instances[i].c8);
+    }
+    free(batch->workers);
+    free(batch->arena);
+    memset(batch, 0, sizeof(*batch));
+}
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// checksums
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+uint64_t sea8_fnv1a(uint64_t hash, const void* data, size_t len)
+{
+    // start with hash = SEA8_FNV_OFFSET
+    const uint8_t* bytes = data;
+    for (size_t i = 0; i < len; ++i) {
+        hash = (hash ^ bytes[i]) * 0x100000001B3ULL;
+    }
+    return hash;
+}
+
+uint64_t sea8_state_hash(const struct Sea8Machine* c8)
+{
+    // everything a ROM can observe except mem, for bit-for-bit run comparisons
+    uint64_t hash = SEA8_FNV_OFFSET;
+    hash = sea8_fnv1a(hash, c8->gfx, sizeof(c8->gfx));
+    hash = sea8_fnv1a(hash, &c8->hires, sizeof(c8->hires));
+    hash = sea8_fnv1a(hash, &c8->planes, sizeof(c8->planes));
+    hash = sea8_fnv1a(hash, c8->V, sizeof(c8->V));
+    // I was a size_t before the fields were packed, widening the 16-bit
+    // field keeps the hash (and the end hash of older recordings) the same
+    uint64_t I = c8->I;
+    hash = sea8_fnv1a(hash, &c8->pc, sizeof(c8->pc));
+    hash = sea8_fnv1a(hash, &I, sizeof(I));
+    hash = sea8_fnv1a(hash, &c8->delay_timer, sizeof(c8->delay_timer));
+    hash = sea8_fnv1a(hash, &c8->sound_timer, sizeof(c8->sound_timer));
+    return hash;
+}
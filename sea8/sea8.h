@@ -0,0 +1,279 @@
+// libsea8, the CHIP-8 interpreter core without a frontend.
+//
+// Load a ROM once (sea8_rom_load from a file, sea8_rom_init from a buffer), start any
+// number of machines from it with sea8_init_rom, then per frame set the
+// keys with sea8_set_keys, tick the timers, run instructions with
+// sea8_emulate_instructions and read the framebuffer from gfx (sea8_gfx_pixel).
+// struct Sea8Batch runs many machines of one ROM on a worker pool.
+//
+// Calls that can fail return an enum Sea8Error. A machine that faults
+// (stack overflow or underflow) halts with pc at the faulting instruction
+// and returns its error from every later call until a state is loaded into
+// it, other machines are not affected.
+//
+// The library is built with the same engine flags as the frontend
+// (SEA8_THREADED, SEA8_DYNAREC, SEA8_PROFILE), none of them changes the
+// structs below.
+
+#ifndef SEA8_H
+#define SEA8_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#define SEA8_INSTR_PER_FRAME 11
+#define SEA8_MEM_SIZE 4096
+#define SEA8_XO_MEM_SIZE 65536 // XO-CHIP, SEA8_MEM_SIZE of it holds code, the rest data (see struct Sea8XoMem)
+#define SEA8_PROGRAM_START 0x200
+#define SEA8_STACK_SIZE 16
+#define SEA8_KEY_COUNT 16
+#define SEA8_REGISTER_COUNT 16
+#define SEA8_SCREEN_WIDTH 64
+#define SEA8_SCREEN_HEIGHT 32
+#define SEA8_HIRES_WIDTH 128 // SCHIP high resolution mode
+#define SEA8_HIRES_HEIGHT 64
+#define SEA8_GFX_WORDS (SEA8_HIRES_WIDTH / 64) // framebuffer words per row of one plane
+#define SEA8_PLANE_COUNT 2 // XO-CHIP bit planes, CHIP-8 and SCHIP only draw to the first
+#define SEA8_GFX_ROW_WORDS (SEA8_PLANE_COUNT * SEA8_GFX_WORDS) // one row of every plane
+#define SEA8_GFX_SIZE (SEA8_HIRES_HEIGHT * SEA8_GFX_ROW_WORDS)
+#define SEA8_GFX_INDEX(y, plane) ((y) * SEA8_GFX_ROW_WORDS + (plane) * SEA8_GFX_WORDS)
+#define SEA8_GFX_WIDTH(hires) ((hires) ? SEA8_HIRES_WIDTH : SEA8_SCREEN_WIDTH)
+#define SEA8_GFX_HEIGHT(hires) ((hires) ? SEA8_HIRES_HEIGHT : SEA8_SCREEN_HEIGHT)
+#ifndef SEA8_LANE_COUNT
+#define SEA8_LANE_COUNT 16
+#endif
+#define SEA8_FNV_OFFSET 0xCBF29CE484222325ULL
+#define SEA8_PAGE_COUNT 16 // mem is shared between clones in pages of SEA8_MEM_SIZE / SEA8_PAGE_COUNT bytes
+#define SEA8_AUDIO_PATTERN_SIZE 16
+#define SEA8_STATE_HEADER_SIZE (16 + SEA8_REGISTER_COUNT + 2 * SEA8_STACK_SIZE + 12 + 8 * SEA8_GFX_SIZE + 4 + SEA8_AUDIO_PATTERN_SIZE)
+#define SEA8_STATE_MAX_SIZE (SEA8_STATE_HEADER_SIZE + SEA8_XO_MEM_SIZE)
+
+_Static_assert(SEA8_PAGE_COUNT <= 16, "dirty_pages is a 16-bit mask");
+_Static_assert(SEA8_HIRES_HEIGHT <= 64, "dirty_rows is a 64-bit mask");
+
+enum Sea8Error {
+    SEA8_OK,
+    SEA8_ERR_OPEN,
+    SEA8_ERR_READ,
+    SEA8_ERR_ROM_TOO_LARGE,
+    SEA8_ERR_NO_MEMORY,
+    SEA8_ERR_BAD_STATE,
+    SEA8_ERR_STACK_OVERFLOW,
+    SEA8_ERR_STACK_UNDERFLOW,
+    SEA8_ERR_THREAD,
+};
+
+const char* sea8_error_string(int error);
+
+// which dispatch engine the library was built with
+extern const char* const sea8_engine_name;
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// machines
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+struct Sea8Stack {
+    uint16_t data[SEA8_STACK_SIZE];
+    uint8_t ptr;
+};
+
+// An idle loop leaves the machine exactly as it was after every iteration
+// while the keys and timers stay the same, which they do for the length of
+// one sea8_emulate_instructions call. The interpreter runs the rest of the
+// budget out at once when it finds one, and records which event can end it.
+enum Sea8Idle {
+    SEA8_IDLE_NONE,
+    SEA8_IDLE_TIMER, // FX07 / SE VX, 0 / JP back, polling the delay timer
+    SEA8_IDLE_INPUT, // jump to self, FX0A waiting or halted, only a key edge (or nothing) ends it
+};
+
+// The behaviors the CHIP-8 variants disagree on (what test05-quirks checks).
+// Each profile runs its own copy of the interpreter loop with the quirks
+// fixed at compile time. None of them waits for vblank before drawing.
+enum Sea8Quirks {
+    SEA8_QUIRKS_CHIP8, // 8XY1/2/3 reset VF, shifts copy VY first, FX55/FX65 advance I, sprites clip
+    SEA8_QUIRKS_SCHIP, // shifts work on VX, FX55/FX65 leave I, BXNN jumps to XNN + VX, sprites clip, DXY0 is 16x16
+    SEA8_QUIRKS_XOCHIP, // as CHIP-8 but 8XY1/2/3 keep VF, sprites wrap around the edges and DXY0 is 16x16
+    SEA8_QUIRKS_COUNT,
+};
+
+// SEA8_QUIRKS_XOCHIP is also the XO-CHIP machine: 64 KB of memory, F000 NNNN,
+// two bit planes, audio patterns, and the SCHIP display instructions, all
+// only in its copy of the interpreter loop. Jumps stay 12 bits, so code
+// always runs from the first SEA8_MEM_SIZE bytes (the pages, with their decoded
+// instructions); the rest is a plain byte block, allocated when a ROM or
+// store first reaches past SEA8_MEM_SIZE.
+
+struct Sea8MemPage; // private to the library, shared copy-on-write between clones
+struct Sea8XoMem; // same, the XO-CHIP memory past SEA8_MEM_SIZE
+
+// Hot fields first: the registers, keys and counters every instruction
+// may touch fill the first 64 bytes, the stack and the page table (read by
+// every fetch) the next three lines, the framebuffer and the XO-CHIP audio
+// come last. A struct Sea8Batch keeps its machines 64-byte aligned, so each of
+// those groups is whole cache lines there.
+struct Sea8Machine {
+    uint8_t V[SEA8_REGISTER_COUNT];
+    // full width: with a uint16_t pc (stored back and zero-extended for the
+    // page lookup on every fetch) 1dcell ran 21-26% slower on the switch
+    // engine, 9% threaded and 5% dynarec, best of 15 runs of 100M instructions
+    size_t pc;
+    uint16_t I; // 16 bits also cover the XO-CHIP address space
+    uint16_t keys; // bit k set = key k down
+    uint16_t prev_keys; // keys at the previous sea8_set_keys, for FX0A
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint8_t idle; // enum Sea8Idle, how the last sea8_emulate_instructions call ended
+    uint8_t error; // enum Sea8Error, nonzero once the machine has halted on a fault
+    uint8_t quirks; // enum Sea8Quirks, SEA8_QUIRKS_CHIP8 unless sea8_set_quirks changes it
+    uint8_t hires; // 128x64 mode (SCHIP 00FF), 00FE switches back to 64x32
+    uint8_t planes; // XO-CHIP FN01, bit p set = draw to plane p, always 1 on CHIP-8 and SCHIP
+    uint8_t xo_dirty; // xo_mem written since chip8_init
+    uint16_t dirty_pages; // bit p set = mem page p written since chip8_init
+    uint64_t rng_state;
+    uint64_t instructions; // executed since chip8_init
+    uint64_t dirty_rows; // bit y set = gfx row y changed since the frontend last drew it
+    struct Sea8Stack stack;
+    struct Sea8MemPage* pages[SEA8_PAGE_COUNT];
+    struct Sea8XoMem* xo_mem; // NULL: no byte past SEA8_MEM_SIZE was written (all read 0)
+    // one bit per pixel, the planes of a row side by side: plane p of row y
+    // is the SEA8_GFX_WORDS words from gfx[SEA8_GFX_INDEX(y, p)], bit 63 of a word is
+    // its leftmost pixel. 64x32 mode only uses the first word of rows 0-31 of
+    // each plane, the rest stays clear.
+    uint64_t gfx[SEA8_GFX_SIZE];
+    uint8_t pitch; // XO-CHIP FX3A, pattern playback rate 4000 * 2^((pitch - 64) / 48) Hz
+    uint8_t audio_pattern[SEA8_AUDIO_PATTERN_SIZE]; // XO-CHIP F002, 128 1-bit samples, MSB first
+    uint32_t unknown_opcodes; // skipped since chip8_init, the host decides whether to report them
+    uint16_t unknown_opcode; // the last one skipped
+    uint16_t unknown_pc; // its address
+};
+
+// A ROM is read and validated once and kept as a freshly initialized
+// machine. sea8_init_rom starts any number of instances from it with one
+// struct copy, they share its (already decoded) pages until they write.
+
+struct Sea8Rom {
+    struct Sea8Machine image;
+    size_t size; // program bytes
+};
+
+int sea8_rom_init(struct Sea8Rom* rom, const uint8_t* program, size_t size);
+int sea8_rom_load(struct Sea8Rom* rom, const char* rom_path);
+void sea8_rom_free(struct Sea8Rom* rom);
+
+void sea8_init_rom(struct Sea8Machine* chip8, const struct Sea8Rom* rom, uint64_t seed);
+int sea8_init_buffer(struct Sea8Machine* chip8, const uint8_t* program, size_t size, uint64_t seed);
+void sea8_clone(struct Sea8Machine* dst, const struct Sea8Machine* src);
+void sea8_free(struct Sea8Machine* chip8);
+void sea8_seed(struct Sea8Machine* chip8, uint64_t seed);
+
+// set on a struct Sea8Rom's image, every instance started from it inherits it.
+// SEA8_ERR_ROM_TOO_LARGE (nothing changed) for a ROM that only fits XO-CHIP.
+int sea8_set_quirks(struct Sea8Machine* chip8, enum Sea8Quirks quirks);
+int sea8_quirks_from_name(const char* name); // "chip8", "schip", "xochip", -1 if unknown
+const char* sea8_quirks_name(int quirks);
+
+void sea8_set_keys(struct Sea8Machine* chip8, uint16_t key_mask);
+void sea8_update_timers(struct Sea8Machine* chip8);
+int sea8_emulate_instructions(struct Sea8Machine* c8, int instr_count);
+
+uint8_t sea8_read(const struct Sea8Machine* chip8, size_t addr);
+uint8_t sea8_gfx_pixel(const uint64_t* gfx, int x, int y); // x, y in the current resolution, bit p = plane p
+void sea8_disassemble(uint16_t opcode, char* out, size_t size);
+
+// Static analysis of a machine's program before it runs: the control flow
+// from SEA8_PROGRAM_START through jumps, calls and skips, which bytes are code
+// and which are read as data at a constant I, and the BNNN jumps whose
+// targets depend on a register. sea8_analyze reads the current mem and
+// quirk profile (skips over F000 NNNN on XO-CHIP).
+
+enum Sea8AnalysisFlags {
+    SEA8_ANALYSIS_CODE = 1, // part of an instruction on some path from SEA8_PROGRAM_START
+    SEA8_ANALYSIS_INSTR = 2, // an instruction starts here
+    SEA8_ANALYSIS_DATA = 4, // read by DXYN, FX33, FX55, FX65, 5XY2/3 or F002 at a known I
+    SEA8_ANALYSIS_JUMP_TARGET = 8, // target of a jump, a skip or a BNNN jump table
+    SEA8_ANALYSIS_CALL_TARGET = 16, // target of a 2NNN, and SEA8_PROGRAM_START
+    SEA8_ANALYSIS_INDIRECT = 32, // BNNN, the target depends on V0 (VX with the SCHIP quirks)
+};
+
+struct Sea8RomAnalysis {
+    uint8_t flags[SEA8_MEM_SIZE]; // enum Sea8AnalysisFlags per byte
+    uint16_t routine[SEA8_MEM_SIZE]; // per instruction, the call target (or SEA8_PROGRAM_START) it was first reached from
+    size_t code_bytes;
+    size_t data_bytes; // read as data and never part of an instruction
+    size_t indirect_jumps;
+};
+
+int sea8_analyze(const struct Sea8Machine* c8, struct Sea8RomAnalysis* analysis);
+void sea8_analysis_print(FILE* out, const struct Sea8Machine* c8, const struct Sea8RomAnalysis* analysis, size_t end);
+
+size_t sea8_state_size(const struct Sea8Machine* c8);
+size_t sea8_save_state(const struct Sea8Machine* c8, uint8_t* buf, size_t buf_size);
+int sea8_load_state(struct Sea8Machine* c8, const struct Sea8Machine* base, const uint8_t* buf, size_t size);
+uint64_t sea8_state_hash(const struct Sea8Machine* c8);
+
+uint64_t sea8_fnv1a(uint64_t hash, const void* data, size_t len);
+uint64_t sea8_read_cycle_counter(void);
+
+#ifdef SEA8_PROFILE
+void sea8_profile_report(FILE* out, const struct Sea8Machine* c8);
+#endif
+
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+// batches
+// ~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~~
+
+struct Sea8KeyEvent {
+    uint64_t cycle; // instruction count at which the key state changes
+    uint16_t keys; // bit k set = key k down
+};
+
+struct Sea8BatchResult {
+    uint64_t gfx[SEA8_GFX_SIZE];
+    uint8_t hires;
+    uint8_t V[SEA8_REGISTER_COUNT];
+    size_t pc;
+    size_t I;
+    uint8_t delay_timer;
+    uint8_t sound_timer;
+    uint64_t cycles;
+    int error; // enum Sea8Error of the instance
+};
+
+struct Sea8BatchInstance;
+struct Sea8BatchWorker;
+
+struct Sea8Batch {
+    struct Sea8BatchInstance* instances; // 64-byte aligned slots inside arena
+    size_t count;
+    void* arena;
+
+    // persistent worker pool, woken once per sea8_batch_step
+    struct Sea8BatchWorker* workers;
+    size_t worker_count;
+    pthread_mutex_t lock;
+    pthread_cond_t start;
+    pthread_cond_t done;
+    uint64_t generation;
+    size_t running;
+    uint64_t step_cycles;
+    int shutdown;
+
+    // run full groups of SEA8_LANE_COUNT instances through struct Chip8Lanes
+    int lockstep;
+    atomic_uint_fast64_t converged_steps;
+    atomic_uint_fast64_t scalar_steps;
+};
+
+// sea8_batch_init returns SEA8_ERR_NO_MEMORY or SEA8_ERR_THREAD (a worker could
+// not be started) with nothing left to free.
+int sea8_batch_init(struct Sea8Batch* batch, const struct Sea8Rom* rom, size_t count, int threads,
+    const uint64_t* seeds, const struct Sea8KeyEvent* const* scripts, const size_t* script_lens);
+void sea8_batch_step(struct Sea8Batch* batch, uint64_t cycles);
+void sea8_batch_collect(const struct Sea8Batch* batch, size_t index, struct Sea8BatchResult* result);
+void sea8_batch_free(struct Sea8Batch* batch);
+
+#endif
@@ -0,0 +1,155 @@
+"""Headless conformance suite and throughput gate for sea8.
+
+Runs every case in tools/goldens.txt through `sea8_headless --trace` with
+its key script and compares the framebuffer hash after the last frame with
+the stored golden. With a local baseline in tools/perf_baseline.txt it then
+runs `--cycles` on the benchmark ROMs and fails when instructions per
+second drop more than --tolerance percent below it.
+
+    python tools/conformance.py
+    python tools/conformance.py --sea8 sea8/sea8_dynarec.exe --tolerance 5
+    python tools/conformance.py --update-goldens      # after a reviewed change
+    python tools/conformance.py --update-baseline     # records the local baseline
+
+Goldens were recorded from screens checked by eye (every test reports OK;
+test05 runs the CHIP-8 profile, test06 the EX9E and FX0A tests). The perf
+baseline is per machine and per engine, so it is not checked in: without
+the file the throughput check is skipped, an engine missing from it only
+reports its numbers.
+"""
+
+import argparse
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+GOLDENS = os.path.join(ROOT, "tools", "goldens.txt")
+BASELINE = os.path.join(ROOT, "tools", "perf_baseline.txt")
+BENCH_ROMS = ["benchmark_roms/1dcell.ch8", "game_roms/tetris.ch8"]
+
+
+def read_table(path):
+    # whitespace separated rows, # starts a comment
+    rows = []
+    with open(path) as f:
+        for line in f:
+            fields = line.split("#")[0].split()
+            if fields:
+                rows.append(fields)
+    return rows
+
+
+def write_table(path, header, rows):
+    with open(path, "w") as f:
+        f.write(header)
+        for row in rows:
+            f.write(" ".join(row) + "\n")
+
+
+def framebuffer_hash(sea8, rom, frames, keys):
+    # keys is "-" or FRAME:MASK,FRAME:MASK,...
+    handle, keys_path = tempfile.mkstemp(suffix=".keys")
+    with os.fdopen(handle, "w") as f:
+        if keys != "-":
+            for event in keys.split(","):
+                f.write(" ".join(event.split(":")) + "\n")
+    try:
+        proc = subprocess.run([sea8, "--trace", str(frames), "--keys", keys_path, os.path.join(ROOT, rom)],
+                              capture_output=True, text=True)
+    finally:
+        os.remove(keys_path)
+
+    lines = proc.stdout.splitlines()
+    if proc.returncode != 0 or len(lines) != frames:
+        return None, (lines[-1:] or [proc.stderr.strip()])[0]
+    return lines[-1].split()[-1], None
+
+
+def throughput(sea8, rom, cycles, runs):
+    # best of several runs, the gate should not trip on one noisy run
+    best = 0
+    engine = "?"
+    for _ in range(runs):
+        out = subprocess.run([sea8, "--cycles", str(cycles), os.path.join(ROOT, rom)],
+                             capture_output=True, text=True).stdout
+        ips = re.search(r"instr/sec:\s+(\d+)", out)
+        name = re.search(r"engine:\s+(\S+)", out)
+        if not ips or not name:
+            return None, None
+        best = max(best, int(ips.group(1)))
+        engine = name.group(1)
+    return engine, best
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("--sea8", default=os.path.join(ROOT, "sea8", "sea8_headless.exe"))
+    parser.add_argument("--tolerance", type=float, default=10.0,
+                        help="allowed throughput drop in percent (default 10)")
+    parser.add_argument("--cycles", type=int, default=200000000)
+    parser.add_argument("--runs", type=int, default=3)
+    parser.add_argument("--no-perf", action="store_true")
+    parser.add_argument("--update-goldens", action="store_true")
+    parser.add_argument("--update-baseline", action="store_true")
+    args = parser.parse_args()
+    args.sea8 = os.path.abspath(args.sea8)
+
+    failures = 0
+
+    print("conformance: {}".format(os.path.basename(args.sea8)))
+    goldens = read_table(GOLDENS)
+    for row in goldens:
+        name, rom, frames, keys, golden = row
+        got, error = framebuffer_hash(args.sea8, rom, int(frames), keys)
+        if error:
+            failures += 1
+            print("  FAIL  {:14} {}".format(name, error))
+        elif args.update_goldens:
+            row[4] = got
+            print("  {}  {:14} {}".format("new " if got != golden else "same", name, got))
+        elif got != golden:
+            failures += 1
+            print("  FAIL  {:14} framebuffer {} expected {}".format(name, got, golden))
+        else:
+            print("  ok    {:14} {}".format(name, got))
+    if args.update_goldens:
+        write_table(GOLDENS, "# name rom frames keys(FRAME:MASK,... or -) framebuffer-hash\n", goldens)
+
+    if not args.no_perf and not args.update_baseline and not os.path.exists(BASELINE):
+        print("throughput: skipped, no local baseline (record one with --update-baseline)")
+    elif not args.no_perf:
+        baseline = {}
+        if os.path.exists(BASELINE):
+            baseline = {(engine, rom): int(ips) for engine, rom, ips in read_table(BASELINE)}
+        print("throughput: best of {} x {} instructions, tolerance {}%".format(args.runs, args.cycles, args.tolerance))
+        for rom in BENCH_ROMS:
+            engine, ips = throughput(args.sea8, rom, args.cycles, args.runs)
+            if ips is None:
+                failures += 1
+                print("  FAIL  {:28} no benchmark output".format(rom))
+                continue
+
+            reference = baseline.get((engine, rom))
+            if args.update_baseline:
+                baseline[(engine, rom)] = ips
+                print("  new   {:9} {:28} {:>14,} instr/sec".format(engine, rom, ips))
+            elif reference is None:
+                print("  ----  {:9} {:28} {:>14,} instr/sec (no baseline)".format(engine, rom, ips))
+            else:
+                change = 100.0 * (ips - reference) / reference
+                ok = change >= -args.tolerance
+                failures += not ok
+                print("  {}  {:9} {:28} {:>14,} instr/sec ({:+.1f}%)".format("ok  " if ok else "SLOW", engine, rom, ips, change))
+        if args.update_baseline:
+            write_table(BASELINE, "# engine rom instr/sec, best of --runs on the machine that recorded it\n",
+                        [[engine, rom, str(ips)] for (engine, rom), ips in sorted(baseline.items())])
+
+    print("{} failures".format(failures) if failures else "all passed")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
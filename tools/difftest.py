@@ -0,0 +1,167 @@
+"""Differential test and benchmark runner for sea8, rusty8 and pyslow8.
+
+Every implementation has a headless --trace FRAMES mode that prints one line
+per frame (pc, I, registers, delay timer and a hash of the framebuffer) for a
+fixed seed and key script. This runs all of them on the test and game ROMs,
+reports the first frame where a trace differs from the reference, then runs
+each one's --cycles benchmark and prints instructions per second.
+
+    python tools/difftest.py
+    python tools/difftest.py --sea8 sea8/sea8_switch.exe sea8/sea8_threaded.exe sea8/sea8_dynarec.exe
+    python tools/difftest.py --rusty8 "" --frames 2000 test_roms/test06-keypad.ch8
+
+An implementation whose command is an empty string is skipped. The exit code
+is 1 when any trace differs.
+"""
+
+import argparse
+import glob
+import os
+import re
+import subprocess
+import sys
+import tempfile
+
+ROOT = os.path.dirname(os.path.dirname(os.path.abspath(__file__)))
+EXE = ".exe" if os.name == "nt" else ""
+
+
+def default_rusty8():
+    path = os.path.join(ROOT, "rusty8", "target", "release", "rusty8" + EXE)
+    return path if os.path.exists(path) else ""
+
+
+def key_script(frames):
+    # press and release every key in turn, held for a few frames with gaps
+    # in between, so FX0A and EX9E/EXA1 paths see both edges
+    lines = ["# generated by difftest.py"]
+    frame = 30
+    key = 0
+    while frame < frames:
+        lines.append("{} {:04x}".format(frame, 1 << key))
+        lines.append("{} 0000".format(frame + 4))
+        frame += 17 + key % 5
+        key = (key * 7 + 3) % 16
+    return "\n".join(lines) + "\n"
+
+
+def run(command, *args):
+    try:
+        proc = subprocess.run(command + list(args), capture_output=True, text=True)
+    except OSError as error:
+        return None, str(error)
+    if proc.returncode != 0:
+        return proc.stdout, (proc.stderr or proc.stdout).strip().splitlines()[-1:] or ["exit {}".format(proc.returncode)]
+    return proc.stdout, None
+
+
+TRACE_LINE = re.compile(r"^\d+ [0-9a-f]{3} ")
+
+
+def trace(command, rom, frames, seed, keys_path):
+    # only the state lines, the implementations differ in what else they
+    # print (e.g. pyslow8 and rusty8 report unknown opcodes)
+    out, error = run(command, "--trace", str(frames), "--seed", str(seed), "--keys", keys_path, rom)
+    return [line for line in (out or "").splitlines() if TRACE_LINE.match(line)], error
+
+
+def compare(reference, lines):
+    # index of the first differing line, None when equal
+    for frame, (a, b) in enumerate(zip(reference, lines)):
+        if a != b:
+            return frame
+    if len(reference) != len(lines):
+        return min(len(reference), len(lines))
+    return None
+
+
+def benchmark(command, rom, cycles):
+    out, error = run(command, "--cycles", str(cycles), "--seed", "0", rom)
+    if error:
+        return None, error
+    match = re.search(r"instr/sec:\s+(\d+)", out)
+    return (int(match.group(1)) if match else None), None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("roms", nargs="*", help="default: test_roms/*.ch8 game_roms/*.ch8")
+    parser.add_argument("--sea8", nargs="+", default=[os.path.join(ROOT, "sea8", "sea8_headless.exe")],
+                        help="one or more sea8 headless builds (e.g. one per engine)")
+    parser.add_argument("--rusty8", default=default_rusty8())
+    parser.add_argument("--pyslow8", default=sys.executable + " " + os.path.join(ROOT, "pyslow8", "main.py"))
+    parser.add_argument("--reference", default="pyslow8",
+                        help="name of the implementation the others are compared to")
+    parser.add_argument("--frames", type=int, default=600)
+    parser.add_argument("--seed", type=int, default=0)
+    parser.add_argument("--keys", help="key script (FRAME KEYS per line), default: generated")
+    parser.add_argument("--bench-rom", default=os.path.join(ROOT, "benchmark_roms", "1dcell.ch8"))
+    parser.add_argument("--cycles", type=int, default=100000000)
+    parser.add_argument("--slow-cycles", type=int, default=2000000, help="cycles for pyslow8")
+    parser.add_argument("--no-bench", action="store_true")
+    args = parser.parse_args()
+
+    engines = []
+    for path in args.sea8:
+        name = "sea8" if len(args.sea8) == 1 else os.path.splitext(os.path.basename(path))[0]
+        engines.append((name, [os.path.abspath(path)], args.cycles))
+    if args.rusty8:
+        engines.append(("rusty8", [os.path.abspath(args.rusty8)], args.cycles))
+    if args.pyslow8:
+        engines.append(("pyslow8", args.pyslow8.split(), args.slow_cycles))
+
+    names = [name for name, _, _ in engines]
+    if args.reference not in names:
+        sys.exit("reference {} is not one of {}".format(args.reference, ", ".join(names)))
+
+    roms = args.roms or sorted(glob.glob(os.path.join(ROOT, "test_roms", "*.ch8"))) + sorted(
+        glob.glob(os.path.join(ROOT, "game_roms", "*.ch8")))
+
+    keys_path = args.keys
+    if not keys_path:
+        handle, keys_path = tempfile.mkstemp(suffix=".keys")
+        with os.fdopen(handle, "w") as f:
+            f.write(key_script(args.frames))
+
+    failures = 0
+    print("traces: {} frames, seed {}, reference {}".format(args.frames, args.seed, args.reference))
+    for rom in roms:
+        traces = {name: trace(command, rom, args.frames, args.seed, keys_path) for name, command, _ in engines}
+        reference, ref_error = traces[args.reference]
+
+        for name, (lines, error) in traces.items():
+            if name == args.reference:
+                continue
+            frame = compare(reference, lines)
+            if frame is None and error == ref_error:
+                print("  ok    {:14} {}".format(name, os.path.basename(rom)))
+                continue
+
+            failures += 1
+            print("  DIFF  {:14} {}".format(name, os.path.basename(rom)))
+            if frame is not None:
+                print("        first difference at frame {}".format(frame))
+                print("        {:14} {}".format(args.reference, reference[frame] if frame < len(reference) else "<end>"))
+                print("        {:14} {}".format(name, lines[frame] if frame < len(lines) else "<end>"))
+            for who, err in ((args.reference, ref_error), (name, error)):
+                if err:
+                    print("        {:14} failed: {}".format(who, " ".join(err) if isinstance(err, list) else err))
+
+    if not args.keys:
+        os.remove(keys_path)
+
+    if not args.no_bench:
+        print("benchmark: {}".format(os.path.basename(args.bench_rom)))
+        for name, command, cycles in engines:
+            ips, error = benchmark(command, args.bench_rom, cycles)
+            if error:
+                print("  {:14} failed: {}".format(name, " ".join(error) if isinstance(error, list) else error))
+            else:
+                print("  {:14} {:>14,} instr/sec ({:.2f} MIPS, {} instructions)".format(name, ips, ips / 1e6, cycles))
+
+    print("{} differences".format(failures) if failures else "all traces match")
+    return 1 if failures else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())